@@ -0,0 +1,626 @@
+// Microbenchmarks for the viewer's hot paths. They live in their own binary
+// so that the viewer carries neither the allocation counter nor the old
+// implementations they are compared against. The viewer source is compiled
+// into this translation unit without its main().
+#define MESHCORETEL_NO_MAIN
+// Helpers that only the viewer's main() calls are unused here.
+#pragma GCC diagnostic ignored "-Wunused-function"
+#include "meshcoretel-viewer.cpp"
+
+namespace {
+
+// Counted by the replaceable operator new below.
+std::atomic<uint64_t> g_heap_allocations{0};
+
+// Blocking fetch on the calling thread's handle; see PrepareHttpGet.
+CURLcode HttpGetStreaming(const std::string &url, curl_write_callback write_fn, void *userdata,
+                          HttpExchange *exchange = nullptr) {
+  CURL *curl = t_curl.Acquire();
+  if (!curl) {
+    return CURLE_FAILED_INIT;
+  }
+  curl_slist *headers = PrepareHttpGet(curl, url, write_fn, userdata, exchange);
+  CURLcode res = curl_easy_perform(curl);
+  FinishHttpGet(curl, exchange, headers);
+  return res;
+}
+
+// Baseline for `events`: the decoder the client used before the jsmn and SAX
+// paths, a full DOM parse followed by per-key lookups.
+bool DecodeEventDocumentDom(std::string_view document, DecodedEvent *event) {
+  event->Clear();
+  json root = json::parse(document.begin(), document.end(), nullptr, false);
+  if (root.is_discarded() || !root.is_object()) {
+    return false;
+  }
+  static const char *const kKeys[] = {"type", "direction", "sender_name", "group_sender_name",
+                                      "advert_name", "origin", "src_hash", "dst_hash"};
+  auto read = [event](const json &value, DecodedEvent::Value *out) {
+    if (value.is_string()) {
+      *out = event->StoreString(value.get_ref<const std::string &>());
+    } else if (value.is_number()) {
+      out->kind = DecodedEvent::Value::Kind::kNumber;
+      out->number = value.get<int64_t>();
+    }
+  };
+  for (int field = 0; field < DecodedEvent::kFieldCount; field++) {
+    auto it = root.find(kKeys[field]);
+    if (it != root.end()) {
+      read(*it, &event->fields[field]);
+    }
+  }
+  auto path_it = root.find("path");
+  if (path_it != root.end() && path_it->is_object()) {
+    auto nodes_it = path_it->find("nodes");
+    if (nodes_it != path_it->end() && nodes_it->is_array()) {
+      event->has_path_nodes = true;
+      for (const auto &node : *nodes_it) {
+        if (event->path_node_count < event->path_nodes.size()) {
+          read(node, &event->path_nodes[event->path_node_count++]);
+        }
+        event->path_node_total++;
+      }
+    }
+  }
+  return true;
+}
+
+std::vector<std::string> MakeBenchEventDocuments() {
+  std::vector<std::string> documents;
+  for (int i = 0; i < 64; i++) {
+    json packet = {
+      {"type", "packet"},
+      {"direction", i % 2 ? "rx" : "tx"},
+      {"sender_name", "Repeater \"" + std::to_string(i) + "\" Москва"},
+      {"origin", "Observer " + std::to_string(i % 7)},
+      {"src_hash", 100 + i},
+      {"dst_hash", 200 + i},
+      {"payload_type", 4},
+      {"rssi", -97 + i % 10},
+      {"snr", 7.25},
+      {"raw", "0a1b2c3d4e5f60718293a4b5c6d7e8f90a1b2c3d4e5f60718293a4b5c6d7e8f9"},
+      {"received_at", "2026-10-16T12:00:00Z"},
+    };
+    documents.push_back(packet.dump());
+
+    json nodes = json::array();
+    for (int hop = 0; hop < 3 + i % 6; hop++) {
+      char token[8];
+      std::snprintf(token, sizeof(token), "%02X", (i * 31 + hop * 17) & 0xFF);
+      nodes.push_back(token);
+    }
+    json propagation = {
+      {"type", "propagation.path"},
+      {"packet_hash", "5f1e0c7a9b3d2e4f"},
+      {"path", {{"nodes", nodes}, {"hop_count", nodes.size()}}},
+      {"observers", {{{"name", "Observer A"}, {"snr", 5.5}}, {{"name", "Observer B"}, {"snr", -3.0}}}},
+    };
+    documents.push_back(propagation.dump());
+  }
+  return documents;
+}
+
+void BenchEventDecoder(const char *name, const std::vector<std::string> &documents,
+                       bool (*decode)(std::string_view, DecodedEvent *)) {
+  constexpr int kRounds = 2000;
+  DecodedEvent event;
+  // One warm-up round so reused buffers reach their steady-state capacity.
+  for (const std::string &document : documents) {
+    decode(document, &event);
+  }
+  uint64_t allocations = g_heap_allocations.load(std::memory_order_relaxed);
+  auto start = std::chrono::steady_clock::now();
+  size_t decoded = 0;
+  for (int round = 0; round < kRounds; round++) {
+    for (const std::string &document : documents) {
+      decoded += decode(document, &event) ? 1 : 0;
+    }
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  allocations = g_heap_allocations.load(std::memory_order_relaxed) - allocations;
+  size_t total = documents.size() * kRounds;
+  std::cout << name << ": " << static_cast<uint64_t>(total / seconds) << " events/s, "
+            << static_cast<double>(allocations) / total << " allocations/event ("
+            << decoded << "/" << total << " decoded)\n";
+}
+
+std::string MakeBenchAdvertsDocument(size_t count) {
+  json adverts = json::array();
+  for (size_t i = 0; i < count; i++) {
+    char key[65];
+    for (int j = 0; j < 64; j++) {
+      key[j] = "0123456789abcdef"[(i * 2654435761u + j * 40503u) % 16];
+    }
+    key[64] = '\0';
+    adverts.push_back({
+      {"id", i},
+      {"node_hash", (i * 7919) % 65536},
+      {"name", "Node " + std::to_string(i) + " \"Москва\""},
+      {"public_key_hex", key},
+      {"is_room_server", i % 11 == 0},
+      {"is_repeater", i % 3 == 0},
+      {"is_chat_node", i % 3 == 1},
+      {"is_sensor", false},
+      {"lat", 55.0 + static_cast<double>(i % 1000) / 1000.0},
+      {"lon", 37.0 + static_cast<double>(i % 997) / 997.0},
+      {"firmware", "v1.8.2"},
+      {"last_seen", "2026-10-16T12:00:00Z"},
+      {"stats", {{"rx", i % 100}, {"tx", i % 50}}},
+    });
+  }
+  return adverts.dump();
+}
+
+template <typename Parse>
+double BestOfThree(Parse parse) {
+  double best = 0.0;
+  for (int run = 0; run < 3; run++) {
+    auto start = std::chrono::steady_clock::now();
+    parse();
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    best = run == 0 ? ms : std::min(best, ms);
+  }
+  return best;
+}
+
+// Baseline for `strings`: Node as it was before the arena, owning its name.
+struct StringNode {
+  int id = 0;
+  int node_hash = 0;
+  double lat = 0.0;
+  double lon = 0.0;
+  bool has_position = false;
+  bool is_room_server = false;
+  bool is_repeater = false;
+  bool is_chat_node = false;
+  bool is_sensor = false;
+  PackedHex public_key;
+  std::string name;
+};
+
+// Gives every parsed name its own string the way the old parser did: built
+// while parsing, then copied into the list.
+std::vector<StringNode> ParseNodesJsonStrings(std::string_view document, StringArena &scratch) {
+  std::vector<StringNode> nodes;
+  for (const Node &node : ParseNodesJson(document, scratch)) {
+    StringNode owned;
+    owned.id = node.id;
+    owned.node_hash = node.node_hash;
+    owned.lat = node.lat;
+    owned.lon = node.lon;
+    owned.has_position = node.has_position;
+    owned.is_room_server = node.is_room_server;
+    owned.is_repeater = node.is_repeater;
+    owned.is_chat_node = node.is_chat_node;
+    owned.is_sensor = node.is_sensor;
+    owned.public_key = node.public_key;
+    owned.name = std::string(node.name);
+    nodes.push_back(owned);
+  }
+  return nodes;
+}
+
+template <typename Run>
+uint64_t CountAllocations(Run run) {
+  uint64_t before = g_heap_allocations.load(std::memory_order_relaxed);
+  run();
+  return g_heap_allocations.load(std::memory_order_relaxed) - before;
+}
+
+// Old per-key dispatch: compare the key against each schema entry in turn.
+int LinearAdvertKeyLookup(std::string_view key) {
+  for (size_t i = 0; i < kAdvertKeys.size(); i++) {
+    if (kAdvertKeys[i] == key) {
+      return static_cast<int>(i);
+    }
+  }
+  return -1;
+}
+
+// Baseline for `fields`: DOM per element followed by one find() per schema
+// key, as the client parsed adverts before the SAX handler.
+bool ParseAdvertElementDom(std::string_view element, StringArena &arena, Node *out) {
+  json item = json::parse(element.begin(), element.end(), nullptr, false);
+  if (item.is_discarded() || !item.is_object()) {
+    return false;
+  }
+  AdvertBuilder builder;
+  builder.arena = &arena;
+  for (const AdvertField &field : kAdvertFields) {
+    auto it = item.find(field.key);
+    if (it == item.end()) {
+      continue;
+    }
+    AdvertScalar scalar;
+    if (it->is_number()) {
+      scalar.number = it->get<double>();
+    } else if (it->is_boolean()) {
+      scalar.kind = AdvertScalar::Kind::kBool;
+      scalar.boolean = it->get<bool>();
+    } else if (it->is_string()) {
+      scalar.kind = AdvertScalar::Kind::kString;
+      scalar.text = &it->get_ref<const std::string &>();
+    } else {
+      continue;
+    }
+    field.set(builder, scalar);
+  }
+  builder.Finish(out);
+  return true;
+}
+
+// Baseline for `lookup`: the linear scan used before PrefixIndex, which
+// upper-cases every key and formats every node_hash. key_hex holds each
+// node's key as the hex text Node used to carry.
+const Node *FindNodeByPropagationTokenLinear(const std::vector<Node> &nodes,
+                                             const std::vector<std::string> &key_hex,
+                                             std::string_view token) {
+  if (token.empty()) {
+    return nullptr;
+  }
+  std::string needle(token);
+  std::transform(needle.begin(), needle.end(), needle.begin(), ::toupper);
+  for (size_t i = 0; i < nodes.size(); i++) {
+    const Node &node = nodes[i];
+    if (!key_hex[i].empty()) {
+      std::string hex(key_hex[i]);
+      std::transform(hex.begin(), hex.end(), hex.begin(), ::toupper);
+      if (hex.rfind(needle, 0) == 0) {
+        return &node;
+      }
+    }
+    if (node.node_hash != 0) {
+      std::ostringstream oss;
+      oss << std::uppercase << std::hex << node.node_hash;
+      std::string hash_hex = oss.str();
+      if (hash_hex.rfind(needle, 0) == 0) {
+        return &node;
+      }
+    }
+  }
+  return nullptr;
+}
+
+// Feeds a whole recorded stream through a framer and decoder over and over
+// and reports wire bytes and the best decode time per event.
+template <typename FeedStream>
+void BenchTransport(const char *name, const std::string &wire, size_t events, FeedStream feed) {
+  // Best of kRepeats runs, so a busy machine does not skew the comparison.
+  constexpr int kRounds = 100;
+  constexpr int kRepeats = 5;
+  SseMessage message;
+  size_t decoded = feed(wire, &message);
+  double seconds = 0.0;
+  for (int repeat = 0; repeat < kRepeats; repeat++) {
+    auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < kRounds; round++) {
+      decoded = feed(wire, &message);
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    seconds = repeat == 0 ? elapsed : std::min(seconds, elapsed);
+  }
+  std::cout << name << ": " << static_cast<double>(wire.size()) / events << " bytes/event, "
+            << seconds * 1e9 / (static_cast<double>(events) * kRounds) << " ns/event ("
+            << decoded << "/" << events << " decoded)\n";
+}
+
+template <typename Lookup>
+void BenchKeyLookup(const char *name, const std::vector<std::string> &keys, Lookup lookup) {
+  constexpr int kRounds = 200000;
+  int sink = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int round = 0; round < kRounds; round++) {
+    for (const std::string &key : keys) {
+      sink += lookup(key);
+    }
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  double total = static_cast<double>(keys.size()) * kRounds;
+  std::cout << name << ": " << seconds * 1e9 / total << " ns/key (checksum " << sink << ")\n";
+}
+
+int RunBenchmark(const std::string &name) {
+  if (name == "events") {
+    std::vector<std::string> documents = MakeBenchEventDocuments();
+    BenchEventDecoder("nlohmann DOM", documents, DecodeEventDocumentDom);
+    BenchEventDecoder("nlohmann SAX", documents, DecodeEventDocumentSax);
+    BenchEventDecoder("jsmn", documents, DecodeEventDocumentJsmn);
+    return 0;
+  }
+  if (name == "adverts") {
+    constexpr size_t kAdverts = 50000;
+    std::string document = MakeBenchAdvertsDocument(kAdverts);
+    std::cout << "document: " << document.size() << " bytes, " << kAdverts << " adverts, "
+              << std::thread::hardware_concurrency() << " hardware threads\n";
+    size_t parsed = 0;
+    double serial = BestOfThree([&]() {
+      StringArena arena;
+      arena.BeginGeneration();
+      parsed = ParseNodesJson(document, arena).size();
+    });
+    std::cout << "streaming: " << serial << " ms (" << parsed << " nodes)\n";
+    for (size_t threads : {1, 2, 4, 8}) {
+      WorkerPool pool(threads);
+      double ms = BestOfThree([&]() {
+        StringArena arena;
+        arena.BeginGeneration();
+        parsed = ParseNodesJsonParallel(document, arena, pool).size();
+      });
+      std::cout << "parallel x" << threads << ": " << ms << " ms, speedup " << serial / ms
+                << " (" << parsed << " nodes)\n";
+    }
+    return 0;
+  }
+  if (name == "strings") {
+    std::string document = MakeBenchAdvertsDocument(20000);
+    // Both paths parse through an arena that has seen the document once, so
+    // the parse costs them the same and only owning the names differs.
+    StringArena arena;
+    StringArena scratch;
+    arena.BeginGeneration();
+    uint64_t first_refresh = CountAllocations([&]() { ParseNodesJson(document, arena); });
+    arena.EndGeneration();
+    scratch.BeginGeneration();
+    ParseNodesJson(document, scratch);
+    scratch.EndGeneration();
+
+    std::vector<Node> arena_nodes;
+    std::vector<StringNode> string_nodes;
+    arena.BeginGeneration();
+    uint64_t arena_refresh =
+        CountAllocations([&]() { arena_nodes = ParseNodesJson(document, arena); });
+    arena.EndGeneration();
+    scratch.BeginGeneration();
+    uint64_t string_refresh =
+        CountAllocations([&]() { string_nodes = ParseNodesJsonStrings(document, scratch); });
+    scratch.EndGeneration();
+    // The render loop copies the node list into its snapshot every frame.
+    uint64_t arena_frame = CountAllocations([&]() { std::vector<Node> copy = arena_nodes; });
+    uint64_t string_frame =
+        CountAllocations([&]() { std::vector<StringNode> copy = string_nodes; });
+    std::cout << arena_nodes.size() << " nodes\n"
+              << "std::string names: " << string_refresh << " allocations/refresh, "
+              << string_frame << " allocations/frame\n"
+              << "arena: " << arena_refresh << " allocations/refresh (" << first_refresh
+              << " on the first), " << arena_frame << " allocations/frame\n"
+              << "saved: " << static_cast<int64_t>(string_refresh - arena_refresh)
+              << " allocations/refresh, " << static_cast<int64_t>(string_frame - arena_frame)
+              << " allocations/frame\n";
+    return 0;
+  }
+  if (name == "fields") {
+    // Keys in the order they appear in an /api/adverts element, including
+    // the ones outside the schema that only need to be rejected.
+    std::vector<std::string> keys = {"id", "node_hash", "name", "public_key_hex",
+                                     "is_room_server", "is_repeater", "is_chat_node",
+                                     "is_sensor", "lat", "lon", "firmware", "last_seen",
+                                     "stats", "rx", "tx"};
+    BenchKeyLookup("linear table", keys, LinearAdvertKeyLookup);
+    BenchKeyLookup("perfect hash", keys,
+                   [](std::string_view key) { return kAdvertKeyTable.Find(key); });
+
+    constexpr size_t kAdverts = 20000;
+    std::string document = MakeBenchAdvertsDocument(kAdverts);
+    std::vector<std::string_view> elements;
+    if (!FindArrayElements(document, &elements)) {
+      return 1;
+    }
+    auto bench_elements = [&](const char *label,
+                              bool (*parse)(std::string_view, StringArena &, Node *)) {
+      size_t parsed = 0;
+      double ms = BestOfThree([&]() {
+        StringArena arena;
+        arena.BeginGeneration();
+        Node node;
+        parsed = 0;
+        for (std::string_view element : elements) {
+          parsed += parse(element, arena, &node) ? 1 : 0;
+        }
+      });
+      std::cout << label << ": " << ms << " ms for " << parsed << " elements\n";
+    };
+    bench_elements("DOM + find per key", ParseAdvertElementDom);
+    bench_elements("SAX + perfect-hash setters",
+                   [](std::string_view element, StringArena &arena, Node *node) {
+                     return ParseAdvertElement(element, arena, node);
+                   });
+    return 0;
+  }
+  if (name == "transport") {
+    // Every variant frames, decodes and takes a lock per dispatched frame, as
+    // CurlWriteSse does; the batched ones carry 16 messages per frame.
+    constexpr size_t kBatchSize = 16;
+    std::vector<std::string> documents = MakeBenchEventDocuments();
+    std::string sse;
+    std::string binary;
+    std::string sse_batched;
+    std::string binary_batched;
+    auto append_frame = [](std::string *wire, const json &message) {
+      std::vector<uint8_t> frame = json::to_msgpack(message);
+      uint32_t length = static_cast<uint32_t>(frame.size());
+      char prefix[4] = {static_cast<char>(length >> 24), static_cast<char>(length >> 16),
+                        static_cast<char>(length >> 8), static_cast<char>(length)};
+      wire->append(prefix, 4);
+      wire->append(frame.begin(), frame.end());
+    };
+    json text_batch = json::array();
+    json binary_batch = json::array();
+    for (size_t i = 0; i < documents.size(); i++) {
+      const char *type = i % 2 ? "propagation" : "packet";
+      json text_message = {{"type", type}, {"data", documents[i]}};
+      json binary_message = {{"type", type}, {"data", json::parse(documents[i])}};
+      sse += "data: " + text_message.dump() + "\n\n";
+      append_frame(&binary, binary_message);
+      text_batch.push_back(text_message);
+      binary_batch.push_back(binary_message);
+      if (text_batch.size() == kBatchSize || i + 1 == documents.size()) {
+        sse_batched += "data: " + json{{"type", "batch"}, {"events", text_batch}}.dump() + "\n\n";
+        append_frame(&binary_batched, json{{"type", "batch"}, {"events", binary_batch}});
+        text_batch = json::array();
+        binary_batch = json::array();
+      }
+    }
+    std::mutex mutex;
+    auto count = [](const SseMessage &message) {
+      return message.type == SseMessage::Type::kBatch ? message.batch_size : 1;
+    };
+    auto feed_sse = [&](const std::string &wire, SseMessage *message) {
+      SseFramer framer;
+      size_t decoded = 0;
+      framer.Feed(wire.data(), wire.size(), [&](const SseFramer::Event &event) {
+        if (DecodeSseMessage(event.data, message)) {
+          std::lock_guard<std::mutex> lock(mutex);
+          decoded += count(*message);
+        }
+      });
+      return decoded;
+    };
+    auto feed_binary = [&](const std::string &wire, SseMessage *message) {
+      LengthPrefixedFramer framer;
+      size_t decoded = 0;
+      framer.Feed(wire.data(), wire.size(), [&](std::string_view frame) {
+        if (DecodeBinaryMessage(frame, message)) {
+          std::lock_guard<std::mutex> lock(mutex);
+          decoded += count(*message);
+        }
+      });
+      return decoded;
+    };
+    BenchTransport("/sse JSON", sse, documents.size(), feed_sse);
+    BenchTransport("/sse JSON, batched", sse_batched, documents.size(), feed_sse);
+    BenchTransport("/stream MessagePack", binary, documents.size(), feed_binary);
+    BenchTransport("/stream MessagePack, batched", binary_batched, documents.size(), feed_binary);
+    return 0;
+  }
+  if (name == "lookup") {
+    std::string document = MakeBenchAdvertsDocument(20000);
+    StringArena arena;
+    arena.BeginGeneration();
+    NodeStore store;
+    store.nodes = ParseNodesJson(document, arena);
+    auto start = std::chrono::steady_clock::now();
+    UpdateNodeIndex(store);
+    double build_ms =
+        std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "index build: " << build_ms << " ms for " << store.nodes.size() << " nodes\n";
+
+    // Propagation hops: 2-hex tokens, a few longer key prefixes and misses.
+    std::vector<std::string> tokens;
+    for (int i = 0; i < 256; i++) {
+      char token[16];
+      std::snprintf(token, sizeof(token), i % 16 == 0 ? "%02x%02X" : "%02X", i, (i * 7) & 0xFF);
+      tokens.push_back(token);
+    }
+    tokens.push_back("zz");
+    auto bench = [&](const char *label, int rounds, auto find) {
+      size_t found = 0;
+      auto begin = std::chrono::steady_clock::now();
+      for (int round = 0; round < rounds; round++) {
+        for (const std::string &token : tokens) {
+          found += find(token) ? 1 : 0;
+        }
+      }
+      double seconds =
+          std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+      double lookups = static_cast<double>(tokens.size()) * rounds;
+      std::cout << label << ": " << seconds * 1e9 / lookups << " ns/lookup (" << found / rounds
+                << "/" << tokens.size() << " found)\n";
+    };
+    std::vector<std::string> key_hex;
+    for (const Node &node : store.nodes) {
+      std::string hex = FormatPackedHex(node.public_key);
+      std::transform(hex.begin(), hex.end(), hex.begin(), ::tolower);
+      key_hex.push_back(hex);
+    }
+    bench("linear scan", 2, [&](const std::string &token) {
+      return FindNodeByPropagationTokenLinear(store.nodes, key_hex, token);
+    });
+    bench("prefix index", 2000, [&](const std::string &token) {
+      return FindNodeByPropagationToken(store, token);
+    });
+    TokenResolutionCache cache;
+    bench("cached index", 2000, [&](const std::string &token) {
+      return ResolvePropagationToken(store, cache, token);
+    });
+    return 0;
+  }
+  if (name == "latency") {
+    // The only benchmark that needs a running server: it times conditional
+    // /api/adverts requests against MESHCORETEL_SERVER_URL. The server
+    // answers them with 304 from its cache, so the round trip is mostly
+    // transport; run once with http:// and once with unix:// to compare.
+    const char *env = std::getenv("MESHCORETEL_SERVER_URL");
+    ServerEndpoint endpoint = ServerEndpoint::Parse(env ? env : "http://localhost:3000");
+    std::string url = endpoint.base_url + "/api/adverts";
+    HttpExchange exchange;
+    exchange.endpoint = &endpoint;
+    std::string body;
+    CURLcode res = HttpGetStreaming(url, CurlWriteToString, &body, &exchange);
+    std::string etag = exchange.Header("etag");
+    if (res != CURLE_OK || exchange.status != 200 || etag.empty()) {
+      std::cerr << "No cached /api/adverts at " << endpoint.Describe() << " ("
+                << (res != CURLE_OK ? curl_easy_strerror(res) : "no ETag") << ")\n";
+      return 1;
+    }
+    constexpr int kRequests = 5000;
+    exchange.request_headers.push_back("If-None-Match: " + etag);
+    std::vector<double> micros;
+    micros.reserve(kRequests);
+    int not_modified = 0;
+    for (int i = 0; i < kRequests; i++) {
+      body.clear();
+      auto begin = std::chrono::steady_clock::now();
+      res = HttpGetStreaming(url, CurlWriteToString, &body, &exchange);
+      micros.push_back(
+          std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - begin)
+              .count());
+      if (res != CURLE_OK) {
+        std::cerr << "Request failed: " << curl_easy_strerror(res) << "\n";
+        return 1;
+      }
+      not_modified += exchange.status == 304 ? 1 : 0;
+    }
+    std::sort(micros.begin(), micros.end());
+    double total = 0.0;
+    for (double value : micros) {
+      total += value;
+    }
+    auto percentile = [&](double p) {
+      return micros[std::min(micros.size() - 1, static_cast<size_t>(p * micros.size()))];
+    };
+    std::cout << endpoint.Describe() << ": " << kRequests << " requests (" << not_modified
+              << " not modified), mean " << total / kRequests << " us, p50 " << percentile(0.5)
+              << " us, p99 " << percentile(0.99) << " us\n";
+    return 0;
+  }
+  std::cerr << "Unknown benchmark: " << name
+            << " (available: events, adverts, strings, fields, transport, lookup, latency)\n";
+  return 1;
+}
+
+}  // namespace
+
+void *operator new(std::size_t size) {
+  g_heap_allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void *ptr = std::malloc(size ? size : 1)) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept {
+  std::free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t) noexcept {
+  std::free(ptr);
+}
+
+int main(int argc, char **argv) {
+  if (argc != 2) {
+    std::cerr << "Usage: " << argv[0]
+              << " <events|adverts|strings|fields|transport|lookup|latency>\n";
+    return 1;
+  }
+  return RunBenchmark(argv[1]);
+}
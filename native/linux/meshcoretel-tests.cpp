@@ -0,0 +1,762 @@
+// Unit tests for the viewer's parsers and data structures. Like the
+// benchmarks, they compile the viewer source without its main(); none of
+// them opens a window or touches the network.
+#define MESHCORETEL_NO_MAIN
+// Helpers that only the viewer's main() calls are unused here.
+#pragma GCC diagnostic ignored "-Wunused-function"
+#include "meshcoretel-viewer.cpp"
+
+namespace {
+
+int g_failures = 0;
+
+#define CHECK(condition)                                                              \
+  do {                                                                                \
+    if (!(condition)) {                                                               \
+      std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK failed: " #condition "\n"; \
+      g_failures++;                                                                   \
+    }                                                                                 \
+  } while (0)
+
+void TestAnimationRing() {
+  AnimationRing<int, 4> ring;
+  for (int i = 0; i < 6; i++) {
+    ring.Push() = i;
+  }
+  CHECK(ring.size() == 4);
+  CHECK(ring.evicted() == 2);
+  std::vector<int> items;
+  ring.CopyTo(&items);
+  CHECK((items == std::vector<int>{2, 3, 4, 5}));
+
+  // Out of order: the odd records go, the rest keep their order across the wrap.
+  std::vector<int> previous;
+  ring.RemoveIf([&](int item, int *kept) {
+    previous.push_back(kept ? *kept : -1);
+    return item % 2 != 0;
+  });
+  CHECK((previous == std::vector<int>{-1, 2, 2, 4}));
+  ring.CopyTo(&items);
+  CHECK((items == std::vector<int>{2, 4}));
+  ring.Push() = 6;
+  ring.Push() = 7;
+  ring.Push() = 8;
+  CHECK(ring.evicted() == 3);
+  ring.CopyTo(&items);
+  CHECK((items == std::vector<int>{4, 6, 7, 8}));
+}
+
+PathAnimation &PushPath(PathPool &pool, size_t count, float value) {
+  std::vector<SDL_FPoint> points(count, SDL_FPoint{value, value});
+  PathAnimation &path = pool.Push(points.data(), points.size());
+  path.key = static_cast<uint64_t>(value);
+  return path;
+}
+
+// Every live path still points at the values it was pushed with.
+bool PathPointsIntact(const PathPool &pool) {
+  for (size_t i = 0; i < pool.size(); i++) {
+    const PathAnimation &path = pool[i];
+    const SDL_FPoint *points = pool.Points(path);
+    for (uint32_t p = 0; p < path.point_count; p++) {
+      if (points[p].x != static_cast<float>(path.key)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+void TestPathPool() {
+  PathPool records;
+  for (size_t i = 0; i <= kMaxPaths; i++) {
+    PushPath(records, 1, static_cast<float>(i));
+  }
+  CHECK(records.size() == kMaxPaths);
+  CHECK(records.evicted() == 1);
+  CHECK(records[0].key == 1);
+
+  // A fifth 1000-point path skips the 96 slots at the end of the buffer and
+  // wraps around into the space of the oldest path, which it evicts.
+  PathPool pool;
+  for (int i = 1; i <= 5; i++) {
+    PushPath(pool, 1000, static_cast<float>(i));
+  }
+  CHECK(pool.size() == 4);
+  CHECK(pool.evicted() == 1);
+  CHECK(pool[3].first_point == 0);
+  CHECK(PathPointsIntact(pool));
+
+  // A path expiring behind a live one keeps its points reserved until that
+  // one goes, so the next push evicts instead of overwriting live points.
+  PathPool expiring;
+  for (int i = 1; i <= 4; i++) {
+    PushPath(expiring, 1000, static_cast<float>(i));
+  }
+  expiring.Expire([](const PathAnimation &path) { return path.key == 2; });
+  CHECK(expiring.size() == 3);
+  PushPath(expiring, 1000, 5.0f);
+  CHECK(expiring.evicted() == 1);
+  CHECK(expiring.size() == 3);
+  CHECK(expiring[0].key == 3);
+  CHECK(PathPointsIntact(expiring));
+
+  std::vector<PathAnimation> paths;
+  std::vector<SDL_FPoint> points;
+  expiring.CopyTo(&paths, &points);
+  CHECK(paths.size() == 3);
+  CHECK(points.size() == 3000);
+  if (paths.size() == 3 && points.size() == 3000) {
+    CHECK(paths[2].first_point == 2000);
+    CHECK(points[paths[2].first_point].x == 5.0f);
+  }
+
+  expiring.Expire([](const PathAnimation &) { return true; });
+  CHECK(expiring.size() == 0);
+  PushPath(expiring, kMaxPathPoints, 6.0f);
+  CHECK(expiring.evicted() == 1);
+  CHECK(PathPointsIntact(expiring));
+}
+
+void TestEventAdmission() {
+  EventAdmission admission;
+  const uint64_t now = 1000;
+  uint64_t key = 1;
+  uint64_t decisions = 0;
+  auto decide = [&](uint64_t event_key, uint64_t time_ms) {
+    decisions++;
+    return admission.Decide(event_key, time_ms);
+  };
+  // A full bucket admits a burst of distinct keys.
+  int admitted = 0;
+  for (int i = 0; i < kTargetEventsPerFrame * 4; i++) {
+    admitted += decide(key++, now) == Admission::kAdmitted ? 1 : 0;
+  }
+  CHECK(admitted == kTargetEventsPerFrame * 4);
+  // A repeat inside the window merges into the animation on screen. Still
+  // within the frame, so the bucket stays empty.
+  CHECK(decide(1, now + kFrameMs - 1) == Admission::kCoalesced);
+
+  // Past the bucket, events are sampled ever more sparsely, but never cut off.
+  std::vector<int> admitted_per_64(4, 0);
+  for (int i = 0; i < 256; i++) {
+    admitted_per_64[i / 64] += decide(key++, now) == Admission::kAdmitted ? 1 : 0;
+  }
+  CHECK((admitted_per_64 == std::vector<int>{32, 16, 8, 4}));
+
+  // Once the window has passed the key is admitted again, from a bucket
+  // refilled for the frames in between.
+  uint64_t later = now + kCoalesceWindowMs + 1;
+  CHECK(decide(1, later) == Admission::kAdmitted);
+  admitted = 0;
+  for (int i = 0; i < kTargetEventsPerFrame * 4; i++) {
+    admitted += decide(key++, later) == Admission::kAdmitted ? 1 : 0;
+  }
+  CHECK(admitted == kTargetEventsPerFrame * 4 - 1);
+
+  const EventAdmission::Counters &counters = admission.counters();
+  CHECK(counters.coalesced == 1);
+  CHECK(counters.admitted + counters.coalesced + counters.dropped == decisions);
+}
+
+void TestCoalescedAnimations() {
+  AnimationRing<MovingPulse, kMaxPulses> pulses;
+  pulses.Push().key = 7;
+  RefreshPulse(pulses, 7, 5000);
+  CHECK(pulses[0].start_time_ms == 5000);
+  CHECK(pulses[0].intensity == 1.0f + kCoalesceIntensityStep);
+
+  PathPool paths;
+  SDL_FPoint point{0.0f, 0.0f};
+  PathAnimation &path = paths.Push(&point, 1);
+  path.key = 7;
+  path.start_time_ms = 100;
+  // Earlier than one duration after startup: the path is still drawing and
+  // keeps its start time.
+  RefreshPath(paths, 7, 200);
+  CHECK(paths[0].start_time_ms == 100);
+  // Finished drawing: the fade restarts from full.
+  RefreshPath(paths, 7, 5000);
+  CHECK(paths[0].start_time_ms == 5000 - static_cast<uint64_t>(paths[0].duration_ms));
+  for (int i = 0; i < 8; i++) {
+    RefreshPath(paths, 7, 5000);
+  }
+  CHECK(paths[0].intensity == kMaxAnimationIntensity);
+}
+
+// Feeds wire to an SseFramer `chunk` bytes at a time and collects the events.
+std::vector<std::pair<std::string, std::string>> FrameSse(SseFramer &framer,
+                                                          const std::string &wire,
+                                                          size_t chunk) {
+  std::vector<std::pair<std::string, std::string>> events;
+  for (size_t pos = 0; pos < wire.size(); pos += chunk) {
+    size_t size = std::min(chunk, wire.size() - pos);
+    framer.Feed(wire.data() + pos, size, [&](const SseFramer::Event &event) {
+      events.emplace_back(std::string(event.type), std::string(event.data));
+    });
+  }
+  return events;
+}
+
+void TestSseFramer() {
+  const std::string wire =
+      "\xEF\xBB\xBF: comment\r\n"
+      "data: one\r\n\r\n"
+      "event: ping\rdata:two\r\rretry: 1500\n"
+      "id: 42\ndata: three\ndata: lines\n\n"
+      "retry: soon\n"
+      "data: partial";
+  for (size_t chunk : {wire.size(), size_t{1}, size_t{2}, size_t{7}}) {
+    SseFramer framer;
+    auto events = FrameSse(framer, wire, chunk);
+    CHECK(events.size() == 3);
+    if (events.size() == 3) {
+      CHECK(events[0] == std::make_pair(std::string("message"), std::string("one")));
+      CHECK(events[1] == std::make_pair(std::string("ping"), std::string("two")));
+      CHECK(events[2] == std::make_pair(std::string("message"), std::string("three\nlines")));
+    }
+    CHECK(framer.last_event_id() == "42");
+    CHECK(framer.retry_ms() == 1500);
+  }
+}
+
+bool ValuesEqual(const DecodedEvent &a, const DecodedEvent::Value &x, const DecodedEvent &b,
+                 const DecodedEvent::Value &y) {
+  if (x.kind != y.kind) {
+    return false;
+  }
+  if (x.kind == DecodedEvent::Value::Kind::kString) {
+    return a.String(x) == b.String(y);
+  }
+  return x.kind != DecodedEvent::Value::Kind::kNumber || (x.number == y.number && x.real == y.real);
+}
+
+bool EventsEqual(const DecodedEvent &a, const DecodedEvent &b) {
+  for (int field = 0; field < DecodedEvent::kFieldCount; field++) {
+    if (!ValuesEqual(a, a.fields[field], b, b.fields[field])) {
+      return false;
+    }
+  }
+  if (a.has_path_nodes != b.has_path_nodes || a.path_node_total != b.path_node_total ||
+      a.path_node_count != b.path_node_count || a.hop_counts != b.hop_counts) {
+    return false;
+  }
+  for (size_t i = 0; i < a.path_node_count; i++) {
+    if (!ValuesEqual(a, a.path_nodes[i], b, b.path_nodes[i])) {
+      return false;
+    }
+  }
+  for (int array = 0; array < DecodedEvent::kHopArrayCount; array++) {
+    for (size_t i = 0; i < a.hop_counts[array]; i++) {
+      if (!ValuesEqual(a, a.hops[array][i], b, b.hops[array][i])) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+std::string ManyHops(size_t count) {
+  std::string document = R"({"type":"propagation.path","path":{"nodes":[)";
+  for (size_t i = 0; i < count; i++) {
+    document += (i ? ",\"" : "\"") + std::to_string(i % 100) + "\"";
+  }
+  return document + "]}}";
+}
+
+void TestEventDecoders() {
+  enum class Expect { kBoth, kSaxOnly, kNeither };
+  struct Case {
+    std::string document;
+    Expect expect;
+  };
+  const Case cases[] = {
+      {R"({"type":"packet","direction":"rx","sender_name":"Alice","origin":"Obs",)"
+       R"("src_hash":12,"dst_hash":-3,"rssi":-97,"snr":7.25})",
+       Expect::kBoth},
+      {R"({"type":"packet","sender_name":"q \" s \\ é 😀 \t","origin":"a\/b"})",
+       Expect::kBoth},
+      {R"({"type":"propagation.path","path":{"nodes":["AB","CD",12,null],)"
+       R"("hop_ids":[1,null,3,4],"hop_lats":[55.5,null,1e1,-0.5],"hop_lons":[37.25,null,2,3]}})",
+       Expect::kBoth},
+      {R"({"src_hash":1e3,"dst_hash":-0,"sender_name":true,"origin":null,"direction":12.9,)"
+       R"("advert_name":[1,{"a":2}],"type":{"x":"y"}})",
+       Expect::kBoth},
+      {R"({"type":"t","path":"AB","x":{"path":{"nodes":["AA"]}}})", Expect::kBoth},
+      {R"({"type":"t","path":{"nodes":"AB","hop_ids":{"a":1}}})", Expect::kBoth},
+      {R"({"type":"a","type":"b","src_hash":9223372036854775807})", Expect::kBoth},
+      {R"( { "type" : "spaced" , "src_hash" : 1 } )", Expect::kBoth},
+      {"{}", Expect::kBoth},
+      {R"({"type":"","origin":"\ud83d\ude00 \u00e9","x":[ 1 , [ ] , { } ]})", Expect::kBoth},
+      {ManyHops(kMaxPathHops + 10), Expect::kBoth},
+      // Over the jsmn token budget.
+      {ManyHops(kMaxEventTokens), Expect::kSaxOnly},
+      // Outside int64: jsmn leaves it to the SAX decoder's conversion.
+      {R"({"src_hash":18446744073709551615})", Expect::kSaxOnly},
+      {R"({"type":"packet","sender_name":"Al)", Expect::kNeither},
+      {R"({"type":"packet")", Expect::kNeither},
+      {R"({"type":"packet",})", Expect::kNeither},
+      {R"({"type":"packet"} x)", Expect::kNeither},
+      {R"({"src_hash":0x10})", Expect::kNeither},
+      {R"({"src_hash":01})", Expect::kNeither},
+      {R"({"src_hash":-nan})", Expect::kNeither},
+      {R"({"src_hash":tru})", Expect::kNeither},
+      {R"({"src_hash":+1})", Expect::kNeither},
+      {R"({"src_hash":1.})", Expect::kNeither},
+      {"{\"type\":\"a\tb\"}", Expect::kNeither},
+      {R"({"type":"\q"})", Expect::kNeither},
+      {R"({"type":"\u12G4"})", Expect::kNeither},
+      {R"({"type":"\ud83d"})", Expect::kNeither},
+      {R"({"type":"\ude00"})", Expect::kNeither},
+      {"{\"type\":\"\xC3\"}", Expect::kNeither},
+      {"{\"type\":\"\xE0\x80\x80\"}", Expect::kNeither},
+      {"{\"type\":\"\xED\xA0\x80\"}", Expect::kNeither},
+      {R"({"type":"a" "origin":"b"})", Expect::kNeither},
+      {R"({,"type":"a"})", Expect::kNeither},
+      {R"({"type":"a",,"origin":"b"})", Expect::kNeither},
+      {R"({"type"::"a"})", Expect::kNeither},
+      {R"({"x":{"a" 1},"type":"a"})", Expect::kNeither},
+      {R"({"x":[1 2],"type":"a"})", Expect::kNeither},
+      {R"({"x":[1,],"type":"a"})", Expect::kNeither},
+      {R"({"x":0x10,"type":"a"})", Expect::kNeither},
+      {R"({"type":"a"}{})", Expect::kNeither},
+      {R"({"type" "packet"})", Expect::kNeither},
+      {R"({"type":"packet":1})", Expect::kNeither},
+      {R"([{"type":"packet"}])", Expect::kNeither},
+  };
+  for (const Case &test : cases) {
+    DecodedEvent jsmn;
+    DecodedEvent sax;
+    DecodedEvent decoded;
+    bool jsmn_ok = DecodeEventDocumentJsmn(test.document, &jsmn);
+    bool sax_ok = DecodeEventDocumentSax(test.document, &sax);
+    bool decoded_ok = DecodeEventDocument(test.document, &decoded);
+    bool as_expected = jsmn_ok == (test.expect == Expect::kBoth) &&
+                       sax_ok == (test.expect != Expect::kNeither) && decoded_ok == sax_ok &&
+                       (!jsmn_ok || EventsEqual(jsmn, sax)) &&
+                       (!decoded_ok || EventsEqual(decoded, sax));
+    if (!as_expected) {
+      std::cerr << "Decoders disagree on " << test.document.substr(0, 80) << " (jsmn "
+                << jsmn_ok << ", SAX " << sax_ok << ")\n";
+    }
+    CHECK(as_expected);
+  }
+
+  DecodedEvent event;
+  CHECK(DecodeEventDocument(R"({"type":"packet","sender_name":"é","src_hash":12})", &event));
+  CHECK(event.GetString(DecodedEvent::kSenderName) == "\xC3\xA9");
+  CHECK(event.fields[DecodedEvent::kSrcHash].number == 12);
+}
+
+void TestSseEnvelope() {
+  SseMessage message;
+  const json packet = {{"type", "packet"}, {"sender_name", "Alice \"A\" \\ é"}, {"src_hash", 12}};
+  const json propagation = {{"type", "propagation.path"},
+                            {"path", {{"nodes", {"AB", "CD"}}}}};
+  struct Case {
+    json envelope;
+    SseMessage::Type type;
+  };
+  const Case cases[] = {
+      {{{"type", "packet"}, {"data", packet.dump()}}, SseMessage::Type::kPacket},
+      {{{"data", propagation.dump()}, {"extra", {1, {{"x", "}"}}}}, {"type", "propagation"}},
+       SseMessage::Type::kPropagation},
+  };
+  for (const Case &test : cases) {
+    CHECK(DecodeSseMessage(test.envelope.dump(), &message));
+    CHECK(message.type == test.type);
+    const std::string &data = test.envelope["data"].get_ref<const std::string &>();
+    CHECK(message.document == data);
+    DecodedEvent expected;
+    CHECK(DecodeEventDocumentSax(data, &expected));
+    CHECK(EventsEqual(message.event, expected));
+  }
+
+  CHECK(DecodeSseMessage(" {\n\"type\" : \"statusUpdate\" , \"connectionStatus\":\"Up \\u00e9\"}",
+                         &message));
+  CHECK(message.type == SseMessage::Type::kStatus);
+  CHECK(message.status == "Up \xC3\xA9");
+  CHECK(DecodeSseMessage(R"({"type":"ping"})", &message));
+  CHECK(message.type == SseMessage::Type::kPing);
+  CHECK(DecodeSseMessage(R"({"type":"replayGap","missed":42})", &message));
+  CHECK(message.type == SseMessage::Type::kReplayGap);
+  CHECK(message.missed == 42);
+  CHECK(DecodeSseMessage(R"({"type":"replayGap","missed":null})", &message));
+  CHECK(message.missed == -1);
+
+  const char *const rejected[] = {
+      R"({"type":"packet","data":"{\"type\":\"packet\"}")",
+      R"({"type":"packet","data":{"type":"packet"}})",
+      R"({"type":"packet","data":""})",
+      R"({"type":"packet","data":"{\"type\":\q}"})",
+      R"({"type":"packet","data":"not json"})",
+      R"({"type":"unknown","data":"{}"})",
+      R"({"type":"packet","data":"{}")",
+      R"(["type","packet"])",
+      "",
+  };
+  for (const char *frame : rejected) {
+    CHECK(!DecodeSseMessage(frame, &message));
+  }
+}
+
+void TestJsonArrayStreamSplitter() {
+  const std::string document =
+      " [ {\"name\": \"a]\\\"}\", \"nested\": [1, {\"x\": 2}]}, 17 , \"s,t\", true,{}]";
+  const std::vector<std::string> expected = {
+      "{\"name\": \"a]\\\"}\", \"nested\": [1, {\"x\": 2}]}", "17", "\"s,t\"", "true", "{}"};
+  for (size_t chunk : {document.size(), size_t{1}, size_t{3}}) {
+    JsonArrayStreamSplitter splitter;
+    std::vector<std::string> elements;
+    for (size_t pos = 0; pos < document.size(); pos += chunk) {
+      splitter.Feed(document.data() + pos, std::min(chunk, document.size() - pos),
+                    [&](std::string_view element) { elements.emplace_back(element); });
+    }
+    CHECK(elements == expected);
+    CHECK(splitter.state() == JsonArrayStreamSplitter::State::kDone);
+  }
+
+  JsonArrayStreamSplitter not_an_array;
+  not_an_array.Feed("{}", 2, [](std::string_view) {});
+  CHECK(not_an_array.state() == JsonArrayStreamSplitter::State::kError);
+}
+
+std::string LengthPrefixed(const json &message) {
+  std::vector<uint8_t> frame = json::to_msgpack(message);
+  uint32_t length = static_cast<uint32_t>(frame.size());
+  std::string wire = {static_cast<char>(length >> 24), static_cast<char>(length >> 16),
+                      static_cast<char>(length >> 8), static_cast<char>(length)};
+  wire.append(frame.begin(), frame.end());
+  return wire;
+}
+
+void TestLengthPrefixedFramer() {
+  json packet = {{"type", "packet"},
+                 {"id", "7"},
+                 {"data", {{"type", "packet"}, {"sender_name", "Alice"}, {"src_hash", 12}}}};
+  json status = {{"type", "statusUpdate"}, {"connectionStatus", "Connected"}};
+  const std::string wire = LengthPrefixed(packet) + LengthPrefixed(status);
+  for (size_t chunk : {wire.size(), size_t{1}, size_t{5}}) {
+    LengthPrefixedFramer framer;
+    std::vector<SseMessage> messages;
+    for (size_t pos = 0; pos < wire.size(); pos += chunk) {
+      bool ok = framer.Feed(wire.data() + pos, std::min(chunk, wire.size() - pos),
+                            [&](std::string_view frame) {
+                              SseMessage message;
+                              CHECK(DecodeBinaryMessage(frame, &message));
+                              messages.push_back(std::move(message));
+                            });
+      CHECK(ok);
+    }
+    CHECK(messages.size() == 2);
+    if (messages.size() != 2) {
+      continue;
+    }
+    CHECK(messages[0].type == SseMessage::Type::kPacket);
+    CHECK(messages[0].id == "7");
+    CHECK(messages[0].event.GetString(DecodedEvent::kSenderName) == "Alice");
+    CHECK(messages[1].type == SseMessage::Type::kStatus);
+    CHECK(messages[1].status == "Connected");
+  }
+
+  LengthPrefixedFramer framer;
+  const char oversized[4] = {0x7f, 0, 0, 0};
+  CHECK(!framer.Feed(oversized, sizeof(oversized), [](std::string_view) {}));
+}
+
+// The /stream frame of an envelope whose "data" is an object, and the /sse
+// frame of the same envelope with "data" serialized to a string.
+std::string MsgpackFrame(const json &envelope) {
+  std::vector<uint8_t> frame = json::to_msgpack(envelope);
+  return std::string(frame.begin(), frame.end());
+}
+
+std::string SseFrame(json envelope) {
+  if (envelope.contains("data")) {
+    envelope["data"] = envelope["data"].dump();
+  }
+  return envelope.dump();
+}
+
+void TestBinaryMessage() {
+  const json envelopes[] = {
+      {{"type", "packet"},
+       {"id", "17"},
+       {"data",
+        {{"type", "packet"},
+         {"sender_name", "Alice \"A\" é"},
+         {"src_hash", 12},
+         {"dst_hash", -3},
+         {"snr", 7.25},
+         {"raw", {1, 2, 3}}}}},
+      {{"extra", {{"data", {{"type", "x"}}}, {"type", "ping"}}},
+       {"type", "propagation"},
+       {"data",
+        {{"type", "propagation.path"},
+         {"path",
+          {{"nodes", {"AB", "CD", nullptr}},
+           {"hop_ids", {1, nullptr, 3}},
+           {"hop_lats", {55.5, nullptr, -1.25}},
+           {"hop_lons", {37.0, nullptr, 2.5}}}}}}},
+      {{"type", "statusUpdate"}, {"connectionStatus", "Connected"}},
+      {{"type", "ping"}},
+      {{"type", "replayGap"}, {"missed", 7}},
+  };
+  for (const json &envelope : envelopes) {
+    SseMessage binary;
+    SseMessage text;
+    CHECK(DecodeBinaryMessage(MsgpackFrame(envelope), &binary));
+    CHECK(DecodeSseMessage(SseFrame(envelope), &text));
+    CHECK(binary.type == text.type);
+    CHECK(binary.status == text.status);
+    CHECK(binary.missed == text.missed);
+    CHECK(EventsEqual(binary.event, text.event));
+  }
+  SseMessage message;
+  CHECK(DecodeBinaryMessage(MsgpackFrame(envelopes[0]), &message));
+  CHECK(message.id == "17");
+  CHECK(message.event.GetString(DecodedEvent::kSenderName) == "Alice \"A\" é");
+
+  std::string truncated = MsgpackFrame(envelopes[0]);
+  truncated.pop_back();
+  const std::string rejected[] = {
+      truncated,
+      MsgpackFrame(json::array({"type", "packet"})),
+      MsgpackFrame({{"type", "unknown"}, {"data", {{"type", "x"}}}}),
+      MsgpackFrame({{"type", "packet"}}),
+      "",
+  };
+  for (const std::string &frame : rejected) {
+    CHECK(!DecodeBinaryMessage(frame, &message));
+  }
+}
+
+void TestPrefixIndex() {
+  const char *const keys[] = {"ab12", "AB", "ab1234", "ff00", "ab12"};
+  std::vector<PrefixIndex::Entry> entries;
+  for (uint32_t i = 0; i < sizeof(keys) / sizeof(keys[0]); i++) {
+    PackedHex key;
+    CHECK(ParsePackedHex(keys[i], &key));
+    entries.push_back(PrefixIndex::MakeEntry(key, i));
+  }
+  PrefixIndex index;
+  index.Build(entries);
+  auto find = [&](const char *prefix) {
+    PackedHex key;
+    ParsePackedHex(prefix, &key);
+    return index.FindFirst(key);
+  };
+  // The lowest node index among all matches wins, as a linear scan would.
+  CHECK(find("a") == 0);
+  CHECK(find("AB") == 0);
+  CHECK(find("ab123") == 2);
+  CHECK(find("ab1234") == 2);
+  CHECK(find("ab12345") == -1);
+  CHECK(find("f") == 3);
+  CHECK(find("0") == -1);
+  CHECK(find("") == -1);
+}
+
+PackedHex Token(const std::string &hex) {
+  PackedHex token;
+  ParsePackedHex(hex, &token);
+  return token;
+}
+
+PackedHex NumberedToken(int i) {
+  char hex[16];
+  std::snprintf(hex, sizeof(hex), "%06X", i);
+  return Token(hex);
+}
+
+void TestTokenResolutionCache() {
+  TokenResolutionCache cache;
+  const PackedHex missing = Token("AB");
+  const PackedHex found = Token("abcd");
+  CHECK(cache.Lookup(missing, 1) == TokenResolutionCache::kNotCached);
+  cache.Insert(missing, 1, -1);
+  cache.Insert(found, 1, 5);
+  CHECK(cache.Lookup(missing, 1) == -1);
+  CHECK(cache.Lookup(found, 1) == 5);
+  // "AB" and "AB00" are different tokens.
+  CHECK(cache.Lookup(Token("AB00"), 1) == TokenResolutionCache::kNotCached);
+
+  // A new node generation invalidates every entry, negative ones included.
+  CHECK(cache.Lookup(missing, 2) == TokenResolutionCache::kNotCached);
+  CHECK(cache.Lookup(found, 2) == TokenResolutionCache::kNotCached);
+  cache.Insert(found, 2, 7);
+  CHECK(cache.Lookup(found, 2) == 7);
+
+  // Longer than 16 hex digits: never cached.
+  const PackedHex key = Token("0123456789ABCDEF01");
+  cache.Insert(key, 2, 3);
+  CHECK(cache.Lookup(key, 2) == TokenResolutionCache::kNotCached);
+
+  const TokenResolutionCache::Counters &counters = cache.counters();
+  CHECK(counters.hits == 2);
+  CHECK(counters.negative_hits == 1);
+  CHECK(counters.misses == 5);
+
+  // LRU within a set: a token used after every insert survives a flood that
+  // evicts an idle one.
+  TokenResolutionCache lru;
+  const PackedHex idle = Token("11");
+  const PackedHex busy = Token("22");
+  lru.Insert(idle, 1, 1);
+  lru.Insert(busy, 1, 2);
+  for (int i = 0; i < static_cast<int>(TokenResolutionCache::kSets * TokenResolutionCache::kWays * 4);
+       i++) {
+    lru.Insert(NumberedToken(i), 1, i);
+    CHECK(lru.Lookup(busy, 1) == 2);
+  }
+  CHECK(lru.Lookup(idle, 1) == TokenResolutionCache::kNotCached);
+}
+
+Node MakeNode(StringArena &arena, int id, const char *name) {
+  Node node;
+  node.id = id;
+  node.name = arena.Intern(name);
+  return node;
+}
+
+void TestApplyAdvertsDelta() {
+  StringArena arena;
+  arena.BeginGeneration();
+  std::vector<Node> current = {MakeNode(arena, 1, "one"), MakeNode(arena, 2, "two"),
+                               MakeNode(arena, 3, "three")};
+  arena.BeginGeneration();
+  AdvertsResponse delta;
+  delta.kind = AdvertsResponse::Kind::kDelta;
+  delta.nodes = {MakeNode(arena, 4, "four"), MakeNode(arena, 2, "two v2")};
+  delta.removed_ids = {3};
+  std::vector<Node> nodes = ApplyAdvertsDelta(current, delta, arena);
+  CHECK(nodes.size() == 3);
+  if (nodes.size() == 3) {
+    CHECK(nodes[0].id == 1 && nodes[0].name == "one");
+    CHECK(nodes[1].id == 2 && nodes[1].name == "two v2");
+    CHECK(nodes[2].id == 4 && nodes[2].name == "four");
+  }
+
+  AdvertsResponse remove_all;
+  remove_all.kind = AdvertsResponse::Kind::kDelta;
+  remove_all.removed_ids = {1, 2, 4};
+  CHECK(ApplyAdvertsDelta(nodes, remove_all, arena).empty());
+}
+
+void TestSseBatch() {
+  const json entries[] = {
+      {{"type", "packet"},
+       {"id", "a-1"},
+       {"data", {{"type", "packet"}, {"sender_name", "Alice"}, {"src_hash", 12}}}},
+      {{"type", "statusUpdate"}, {"connectionStatus", "Connected"}},
+      {{"type", "unknown"}, {"data", {{"type", "x"}}}},
+      {{"type", "propagation"},
+       {"data", {{"type", "propagation.path"}, {"path", {{"nodes", {"AB", "CD"}}}}}}},
+      {{"type", "batch"}, {"events", json::array({{{"type", "ping"}}})}},
+      5,
+      {{"type", "ping"}},
+  };
+  const SseMessage::Type expected[] = {SseMessage::Type::kPacket, SseMessage::Type::kStatus,
+                                       SseMessage::Type::kPropagation, SseMessage::Type::kPing};
+  json binary_events = json::array();
+  json text_events = json::array();
+  for (const json &entry : entries) {
+    binary_events.push_back(entry);
+    text_events.push_back(entry.is_object() ? json::parse(SseFrame(entry)) : entry);
+  }
+  SseMessage binary;
+  SseMessage text;
+  CHECK(DecodeBinaryMessage(
+      MsgpackFrame({{"type", "batch"}, {"id", "a-7"}, {"events", binary_events}}), &binary));
+  CHECK(DecodeSseMessage(json({{"type", "batch"}, {"events", text_events}}).dump(), &text));
+  for (const SseMessage *message : {&binary, &text}) {
+    CHECK(message->type == SseMessage::Type::kBatch);
+    CHECK(message->batch_size == std::size(expected));
+    if (message->batch_size != std::size(expected)) {
+      continue;
+    }
+    for (size_t i = 0; i < message->batch_size; i++) {
+      CHECK(message->batch[i].type == expected[i]);
+    }
+    CHECK(message->batch[0].event.GetString(DecodedEvent::kSenderName) == "Alice");
+    CHECK(message->batch[1].status == "Connected");
+  }
+  CHECK(binary.id == "a-7");
+  CHECK(binary.batch[0].id == "a-1");
+  for (size_t i = 0; i < std::min(binary.batch_size, text.batch_size); i++) {
+    CHECK(EventsEqual(binary.batch[i].event, text.batch[i].event));
+  }
+
+  // A smaller batch reuses the entries of the larger one.
+  CHECK(DecodeSseMessage(R"({"type":"batch","events":[{"type":"ping"}]})", &text));
+  CHECK(text.batch_size == 1);
+  CHECK(text.batch.size() >= std::size(expected));
+  CHECK(DecodeSseMessage(R"({"type":"batch","events":[]})", &text));
+  CHECK(text.type == SseMessage::Type::kBatch);
+  CHECK(text.batch_size == 0);
+
+  std::string truncated =
+      MsgpackFrame({{"type", "batch"}, {"events", json::array({entries[0], entries[1]})}});
+  truncated.pop_back();
+  CHECK(!DecodeBinaryMessage(truncated, &binary));
+  const char *const rejected[] = {
+      R"({"type":"batch","events":[{"type":"ping"})",
+      R"({"type":"batch","events":[{"type":"ping"},{"type":]})",
+      R"({"type":"batch","events":[{"type":"ping"}}})",
+  };
+  for (const char *frame : rejected) {
+    CHECK(!DecodeSseMessage(frame, &text));
+  }
+}
+
+void TestTimerWheel() {
+  uint64_t now = 100000;
+  TimerWheel wheel(now);
+  std::vector<int> fired;
+  wheel.Schedule(now, 30, [&]() { fired.push_back(30); });
+  uint64_t cancelled = wheel.Schedule(now, 20, [&]() { fired.push_back(20); });
+  // Past one revolution of the wheel; must not fire on the first lap.
+  wheel.Schedule(now, TimerWheel::kTickMs * TimerWheel::kSlots + 50,
+                 [&]() { fired.push_back(-1); });
+  wheel.Schedule(now, 10, [&]() {
+    fired.push_back(10);
+    wheel.Schedule(now + 10, 0, [&]() { fired.push_back(11); });
+  });
+  CHECK(wheel.NextTimeoutMs(now) == 10);
+  wheel.Cancel(cancelled);
+
+  wheel.Advance(now + 9);
+  CHECK(fired.empty());
+  wheel.Advance(now + 40);
+  CHECK((fired == std::vector<int>{10, 11, 30}));
+  CHECK(wheel.NextTimeoutMs(now + 40) > 0);
+  wheel.Advance(now + TimerWheel::kTickMs * TimerWheel::kSlots + 60);
+  CHECK((fired == std::vector<int>{10, 11, 30, -1}));
+  CHECK(wheel.NextTimeoutMs(now) == -1);
+}
+
+}  // namespace
+
+int main() {
+  TestAnimationRing();
+  TestPathPool();
+  TestEventAdmission();
+  TestCoalescedAnimations();
+  TestSseFramer();
+  TestSseEnvelope();
+  TestEventDecoders();
+  TestJsonArrayStreamSplitter();
+  TestLengthPrefixedFramer();
+  TestBinaryMessage();
+  TestPrefixIndex();
+  TestTokenResolutionCache();
+  TestApplyAdvertsDelta();
+  TestSseBatch();
+  TestTimerWheel();
+  if (g_failures > 0) {
+    std::cerr << g_failures << " check(s) failed\n";
+    return 1;
+  }
+  std::cout << "All tests passed\n";
+  return 0;
+}
@@ -4,30 +4,45 @@
 #include <curl/curl.h>
 
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <cmath>
+#include <condition_variable>
+#include <cerrno>
 #include <cstdint>
 #include <cstdlib>
 #include <ctime>
 #include <cstring>
 #include <deque>
+#include <filesystem>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <memory>
 #include <mutex>
+#include <new>
 #include <sstream>
 #include <string>
+#include <string_view>
 #include <thread>
 #include <chrono>
 #include <csignal>
 #include <execinfo.h>
 #include <exception>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <random>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
+#include "jsmn.h"
 #include "json.hpp"
 
 namespace {
 using nlohmann::json;
-std::mutex g_json_mutex;
 constexpr int kDefaultWidth = 1280;
 constexpr int kDefaultHeight = 720;
 constexpr int kTileSize = 256;
@@ -35,8 +50,67 @@ constexpr int kDefaultZoom = 10;
 constexpr double kMoscowLat = 55.7558;
 constexpr double kMoscowLon = 37.6176;
 constexpr int kMaxPacketMessages = 5;
+constexpr size_t kMaxPulses = 256;
+constexpr size_t kMaxPaths = 128;
+constexpr size_t kMaxPathPoints = 4096;
+constexpr size_t kMaxPathHops = 64;
+constexpr uint64_t kFrameMs = 16;
+constexpr int kTargetEventsPerFrame = 4;
+constexpr uint64_t kCoalesceWindowMs = 400;
+constexpr float kCoalesceIntensityStep = 0.5f;
+constexpr float kMaxAnimationIntensity = 3.0f;
+constexpr uint64_t kStatsLogIntervalMs = 30000;
 constexpr double kPi = 3.14159265358979323846;
 
+int HexDigitValue(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+// Up to 64 hex digits packed two per byte, high nibble first; nibbles == 0
+// means no key.
+struct PackedHex {
+  std::array<uint8_t, 32> bytes{};
+  uint8_t nibbles = 0;
+
+  bool empty() const { return nibbles == 0; }
+};
+
+// Returns false, leaving *out empty, for non-hex input or more than 64 digits.
+bool ParsePackedHex(std::string_view hex, PackedHex *out) {
+  *out = PackedHex{};
+  if (hex.size() > out->bytes.size() * 2) {
+    return false;
+  }
+  for (size_t i = 0; i < hex.size(); i++) {
+    int value = HexDigitValue(hex[i]);
+    if (value < 0) {
+      *out = PackedHex{};
+      return false;
+    }
+    out->bytes[i / 2] |= static_cast<uint8_t>(i % 2 ? value : value << 4);
+  }
+  out->nibbles = static_cast<uint8_t>(hex.size());
+  return true;
+}
+
+std::string FormatPackedHex(const PackedHex &key) {
+  std::string hex(key.nibbles, '0');
+  for (size_t i = 0; i < key.nibbles; i++) {
+    uint8_t byte = key.bytes[i / 2];
+    hex[i] = "0123456789ABCDEF"[i % 2 ? byte & 0x0F : byte >> 4];
+  }
+  return hex;
+}
+
 struct Node {
   int id = 0;
   int node_hash = 0;
@@ -47,8 +121,208 @@ struct Node {
   bool is_repeater = false;
   bool is_chat_node = false;
   bool is_sensor = false;
-  std::string name;
-  std::string public_key_hex;
+  PackedHex public_key;
+  // View into the StringArena generation held by the owning NodeStore.
+  std::string_view name;
+};
+
+using StringChunks = std::vector<std::shared_ptr<char[]>>;
+
+// Interning bump allocator for node strings. A published NodeStore holds the
+// chunks of its generation, so its views survive the arena starting over.
+class StringArena {
+ public:
+  struct Stats {
+    size_t interned = 0;
+    size_t reused = 0;
+    size_t chunk_allocs = 0;
+  };
+
+  void BeginGeneration() {
+    generation_++;
+    stats_ = Stats{};
+    // Start over once most of the arena is garbage; older stores keep the old chunks.
+    if (dead_bytes_ > kChunkSize && dead_bytes_ > live_bytes_) {
+      chunks_.clear();
+      index_.clear();
+      cursor_ = nullptr;
+      chunk_used_ = kChunkSize;
+      dead_bytes_ = 0;
+      live_bytes_ = 0;
+    }
+  }
+
+  std::string_view Intern(std::string_view text) {
+    if (text.empty()) {
+      return {};
+    }
+    stats_.interned++;
+    auto it = index_.find(text);
+    if (it != index_.end()) {
+      stats_.reused++;
+      it->second = generation_;
+      return it->first;
+    }
+    char *dst = Allocate(text.size());
+    std::memcpy(dst, text.data(), text.size());
+    std::string_view stored(dst, text.size());
+    index_.emplace(stored, generation_);
+    return stored;
+  }
+
+  // Forgets strings not seen this generation and returns its chunks.
+  StringChunks EndGeneration() {
+    live_bytes_ = 0;
+    for (auto it = index_.begin(); it != index_.end();) {
+      if (it->second != generation_) {
+        dead_bytes_ += it->first.size();
+        it = index_.erase(it);
+      } else {
+        live_bytes_ += it->first.size();
+        ++it;
+      }
+    }
+    return chunks_;
+  }
+
+  const Stats &stats() const { return stats_; }
+
+ private:
+  static constexpr size_t kChunkSize = 64 * 1024;
+
+  char *Allocate(size_t size) {
+    if (size > kChunkSize / 4) {
+      chunks_.emplace_back(new char[size]);
+      stats_.chunk_allocs++;
+      return chunks_.back().get();
+    }
+    if (chunk_used_ + size > kChunkSize) {
+      chunks_.emplace_back(new char[kChunkSize]);
+      stats_.chunk_allocs++;
+      cursor_ = chunks_.back().get();
+      chunk_used_ = 0;
+    }
+    char *dst = cursor_ + chunk_used_;
+    chunk_used_ += size;
+    return dst;
+  }
+
+  StringChunks chunks_;
+  std::unordered_map<std::string_view, uint64_t> index_;
+  char *cursor_ = nullptr;
+  size_t chunk_used_ = kChunkSize;
+  size_t live_bytes_ = 0;
+  size_t dead_bytes_ = 0;
+  uint64_t generation_ = 0;
+  Stats stats_;
+};
+
+// Sorted packed keys plus a min segment tree over node indices, so a prefix
+// lookup returns the first match in list order, as a linear scan would.
+class PrefixIndex {
+ public:
+  using Words = std::array<uint64_t, 4>;
+
+  struct Entry {
+    Words words{};
+    uint32_t node = 0;
+    uint8_t nibbles = 0;
+  };
+
+  static Words ToWords(const PackedHex &key) {
+    Words words{};
+    for (size_t w = 0; w < words.size(); w++) {
+      for (size_t b = 0; b < 8; b++) {
+        words[w] = (words[w] << 8) | key.bytes[w * 8 + b];
+      }
+    }
+    return words;
+  }
+
+  static Entry MakeEntry(const PackedHex &key, uint32_t node) {
+    Entry entry;
+    entry.words = ToWords(key);
+    entry.node = node;
+    entry.nibbles = key.nibbles;
+    return entry;
+  }
+
+  void Build(std::vector<Entry> entries) {
+    // Zero-padded words, then length, is the lexicographic order of the
+    // digit strings: a key sorts right before its own extensions.
+    std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) {
+      if (a.words != b.words) {
+        return a.words < b.words;
+      }
+      return a.nibbles != b.nibbles ? a.nibbles < b.nibbles : a.node < b.node;
+    });
+    entries_ = std::move(entries);
+    size_t count = entries_.size();
+    min_node_.assign(count * 2, 0);
+    for (size_t i = 0; i < count; i++) {
+      min_node_[count + i] = entries_[i].node;
+    }
+    for (size_t i = count; i-- > 1;) {
+      min_node_[i] = std::min(min_node_[2 * i], min_node_[2 * i + 1]);
+    }
+  }
+
+  long FindFirst(const PackedHex &prefix) const {
+    if (prefix.empty() || entries_.empty()) {
+      return -1;
+    }
+    Words wanted = ToWords(prefix);
+    Words mask{};
+    for (size_t w = 0; w < mask.size(); w++) {
+      int bits = std::clamp(static_cast<int>(prefix.nibbles) * 4 - static_cast<int>(w) * 64, 0, 64);
+      mask[w] = bits == 64 ? ~uint64_t{0} : bits == 0 ? 0 : ~(~uint64_t{0} >> bits);
+    }
+    auto compare = [&](const Entry &entry) {
+      for (size_t w = 0; w < mask.size(); w++) {
+        uint64_t key = entry.words[w] & mask[w];
+        if (key != wanted[w]) {
+          return key < wanted[w] ? -1 : 1;
+        }
+      }
+      return entry.nibbles < prefix.nibbles ? -1 : 0;
+    };
+    auto lo = std::partition_point(entries_.begin(), entries_.end(),
+                                   [&](const Entry &entry) { return compare(entry) < 0; });
+    auto hi = std::partition_point(lo, entries_.end(),
+                                   [&](const Entry &entry) { return compare(entry) == 0; });
+    if (lo == hi) {
+      return -1;
+    }
+    size_t count = entries_.size();
+    size_t left = static_cast<size_t>(lo - entries_.begin()) + count;
+    size_t right = static_cast<size_t>(hi - entries_.begin()) + count;
+    uint32_t best = UINT32_MAX;
+    for (; left < right; left /= 2, right /= 2) {
+      if (left & 1) {
+        best = std::min(best, min_node_[left++]);
+      }
+      if (right & 1) {
+        best = std::min(best, min_node_[--right]);
+      }
+    }
+    return static_cast<long>(best);
+  }
+
+  size_t size() const { return entries_.size(); }
+
+ private:
+  std::vector<Entry> entries_;
+  std::vector<uint32_t> min_node_;
+};
+
+// Immutable result of one adverts refresh, shared by pointer across threads.
+struct NodeStore {
+  uint64_t generation = 0;
+  std::vector<Node> nodes;
+  std::unordered_map<int, size_t> node_hash_index;
+  StringChunks strings;
+  PrefixIndex public_key_index;
+  PrefixIndex token_index;
 };
 
 struct PacketMessage {
@@ -61,26 +335,389 @@ struct MovingPulse {
   SDL_FPoint end;
   uint64_t start_time_ms = 0;
   float duration_ms = 1200.0f;
+  // Admission key; coalesced repeats find the pulse by it.
+  uint64_t key = 0;
+  float intensity = 1.0f;
 };
 
 struct PathAnimation {
-  std::vector<SDL_FPoint> points;
+  uint32_t first_point = 0;
+  uint32_t point_count = 0;
+  // point_count plus any slots skipped to keep the range contiguous at the wrap,
+  // plus the slots of expired paths that followed this one in the buffer.
+  uint32_t reserved_points = 0;
   uint64_t start_time_ms = 0;
   float duration_ms = 1500.0f;
   SDL_Color color{0, 255, 234, 255};
   float width = 2.0f;
+  uint64_t key = 0;
+  float intensity = 1.0f;
+};
+
+// Fixed-capacity FIFO. Expiry removes records from anywhere; pushing into a
+// full ring evicts the oldest.
+template <typename T, size_t N>
+class AnimationRing {
+ public:
+  T &Push() {
+    if (size_ == N) {
+      PopFront();
+      evicted_++;
+    }
+    T &slot = items_[(head_ + size_) % N];
+    slot = T{};
+    size_++;
+    return slot;
+  }
+
+  void PopFront() {
+    head_ = (head_ + 1) % N;
+    size_--;
+  }
+
+  // remove(record, previous) sees the last record kept before it, or null.
+  template <typename Remove>
+  void RemoveIf(Remove remove) {
+    size_t kept = 0;
+    for (size_t i = 0; i < size_; i++) {
+      T *previous = kept > 0 ? &items_[(head_ + kept - 1) % N] : nullptr;
+      T &item = items_[(head_ + i) % N];
+      if (remove(item, previous)) {
+        continue;
+      }
+      if (kept != i) {
+        items_[(head_ + kept) % N] = item;
+      }
+      kept++;
+    }
+    size_ = kept;
+  }
+
+  void CopyTo(std::vector<T> *out) const {
+    out->clear();
+    for (size_t i = 0; i < size_; i++) {
+      out->push_back((*this)[i]);
+    }
+  }
+
+  const T &Front() const { return items_[head_]; }
+  T &operator[](size_t i) { return items_[(head_ + i) % N]; }
+  const T &operator[](size_t i) const { return items_[(head_ + i) % N]; }
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  uint64_t evicted() const { return evicted_; }
+
+ private:
+  std::array<T, N> items_{};
+  size_t head_ = 0;
+  size_t size_ = 0;
+  uint64_t evicted_ = 0;
+};
+
+// Path records plus a point buffer bump-allocated in the same FIFO order, so
+// freeing the oldest path frees the oldest points.
+class PathPool {
+ public:
+  PathAnimation &Push(const SDL_FPoint *points, size_t count) {
+    count = std::min(count, kMaxPathPoints);
+    size_t gap = 0;
+    while (true) {
+      gap = write_ + count > kMaxPathPoints ? kMaxPathPoints - write_ : 0;
+      if (records_.size() < kMaxPaths && points_used_ + gap + count <= kMaxPathPoints) {
+        break;
+      }
+      PopFront();
+      evicted_++;
+    }
+    if (gap > 0) {
+      write_ = 0;
+    }
+    PathAnimation &path = records_.Push();
+    path.first_point = static_cast<uint32_t>(write_);
+    path.point_count = static_cast<uint32_t>(count);
+    path.reserved_points = static_cast<uint32_t>(gap + count);
+    std::copy(points, points + count, points_.begin() + write_);
+    write_ = (write_ + count) % kMaxPathPoints;
+    points_used_ += gap + count;
+    return path;
+  }
+
+  // Points of a path expiring behind a live one cannot be reused until the live
+  // one goes, so they are folded into its reservation.
+  template <typename Expired>
+  void Expire(Expired expired) {
+    records_.RemoveIf([&](const PathAnimation &path, PathAnimation *previous) {
+      if (!expired(path)) {
+        return false;
+      }
+      if (previous) {
+        previous->reserved_points += path.reserved_points;
+      } else {
+        points_used_ -= path.reserved_points;
+      }
+      return true;
+    });
+    if (records_.empty()) {
+      write_ = 0;
+      points_used_ = 0;
+    }
+  }
+
+  void CopyTo(std::vector<PathAnimation> *paths, std::vector<SDL_FPoint> *points) const {
+    paths->clear();
+    points->clear();
+    for (size_t i = 0; i < records_.size(); i++) {
+      PathAnimation path = records_[i];
+      const SDL_FPoint *first = Points(path);
+      path.first_point = static_cast<uint32_t>(points->size());
+      points->insert(points->end(), first, first + path.point_count);
+      paths->push_back(path);
+    }
+  }
+
+  const SDL_FPoint *Points(const PathAnimation &path) const {
+    return points_.data() + path.first_point;
+  }
+
+  PathAnimation &operator[](size_t i) { return records_[i]; }
+  const PathAnimation &operator[](size_t i) const { return records_[i]; }
+  size_t size() const { return records_.size(); }
+  uint64_t evicted() const { return evicted_; }
+
+ private:
+  void PopFront() {
+    points_used_ -= records_.Front().reserved_points;
+    records_.PopFront();
+    if (records_.empty()) {
+      write_ = 0;
+      points_used_ = 0;
+    }
+  }
+
+  AnimationRing<PathAnimation, kMaxPaths> records_;
+  std::array<SDL_FPoint, kMaxPathPoints> points_{};
+  size_t write_ = 0;
+  size_t points_used_ = 0;
+  uint64_t evicted_ = 0;
+};
+
+enum class Admission { kAdmitted, kCoalesced, kDropped };
+
+// Token bucket refilled every frame; once empty, events are sampled with a
+// stride that doubles with the overflow. Repeats within the coalesce window
+// merge into the animation on screen.
+class EventAdmission {
+ public:
+  struct Counters {
+    uint64_t admitted = 0;
+    uint64_t coalesced = 0;
+    uint64_t dropped = 0;
+  };
+
+  Admission Decide(uint64_t key, uint64_t now_ms) {
+    Refill(now_ms);
+    for (const auto &entry : recent_) {
+      if (entry.time_ms != 0 && entry.key == key &&
+          now_ms - entry.time_ms <= kCoalesceWindowMs) {
+        counters_.coalesced++;
+        return Admission::kCoalesced;
+      }
+    }
+    if (tokens_ > 0) {
+      tokens_--;
+    } else {
+      overflow_++;
+      uint32_t stride = 2u << std::min<uint32_t>(3, overflow_ / 64);
+      if (overflow_ % stride != 0) {
+        counters_.dropped++;
+        return Admission::kDropped;
+      }
+    }
+    recent_[recent_next_] = RecentKey{key, now_ms};
+    recent_next_ = (recent_next_ + 1) % recent_.size();
+    counters_.admitted++;
+    return Admission::kAdmitted;
+  }
+
+  const Counters &counters() const { return counters_; }
+
+ private:
+  struct RecentKey {
+    uint64_t key = 0;
+    uint64_t time_ms = 0;
+  };
+
+  void Refill(uint64_t now_ms) {
+    if (last_refill_ms_ == 0) {
+      last_refill_ms_ = now_ms;
+      return;
+    }
+    uint64_t frames = (now_ms - last_refill_ms_) / kFrameMs;
+    if (frames == 0) {
+      return;
+    }
+    last_refill_ms_ += frames * kFrameMs;
+    uint64_t refill = frames * kTargetEventsPerFrame;
+    tokens_ = static_cast<int>(std::min<uint64_t>(kBurst, tokens_ + refill));
+    overflow_ = frames >= 32 ? 0 : overflow_ >> frames;
+  }
+
+  static constexpr int kBurst = kTargetEventsPerFrame * 4;
+
+  int tokens_ = kBurst;
+  uint32_t overflow_ = 0;
+  uint64_t last_refill_ms_ = 0;
+  std::array<RecentKey, 64> recent_{};
+  size_t recent_next_ = 0;
+  Counters counters_;
+};
+
+// 4-way set-associative cache of hop token -> node index, misses included.
+// Entries carry the NodeStore generation, so a refresh invalidates them all.
+class TokenResolutionCache {
+ public:
+  static constexpr size_t kSets = 256;
+  static constexpr size_t kWays = 4;
+  static constexpr long kNotCached = -2;
+
+  struct Counters {
+    uint64_t hits = 0;
+    uint64_t negative_hits = 0;
+    uint64_t misses = 0;
+  };
+
+  // Node index, -1 for a token known to match nothing, or kNotCached.
+  long Lookup(const PackedHex &token, uint64_t generation) {
+    if (!Cacheable(token)) {
+      counters_.misses++;
+      return kNotCached;
+    }
+    uint64_t tag = Tag(token);
+    Entry *set = &entries_[SetOf(tag, token.nibbles) * kWays];
+    for (size_t way = 0; way < kWays; way++) {
+      Entry &entry = set[way];
+      if (entry.tag == tag && entry.nibbles == token.nibbles && entry.generation == generation) {
+        entry.last_used = ++clock_;
+        if (entry.node < 0) {
+          counters_.negative_hits++;
+        } else {
+          counters_.hits++;
+        }
+        return entry.node;
+      }
+    }
+    counters_.misses++;
+    return kNotCached;
+  }
+
+  void Insert(const PackedHex &token, uint64_t generation, long node) {
+    if (!Cacheable(token)) {
+      return;
+    }
+    uint64_t tag = Tag(token);
+    Entry *set = &entries_[SetOf(tag, token.nibbles) * kWays];
+    Entry *victim = &set[0];
+    for (size_t way = 0; way < kWays; way++) {
+      Entry &entry = set[way];
+      if (entry.generation != generation) {
+        victim = &entry;
+        break;
+      }
+      if (entry.last_used < victim->last_used) {
+        victim = &entry;
+      }
+    }
+    victim->tag = tag;
+    victim->nibbles = token.nibbles;
+    victim->generation = generation;
+    victim->node = static_cast<int32_t>(node);
+    victim->last_used = ++clock_;
+  }
+
+  const Counters &counters() const { return counters_; }
+
+ private:
+  struct Entry {
+    uint64_t tag = 0;
+    uint64_t generation = 0;
+    uint32_t last_used = 0;
+    int32_t node = -1;
+    uint8_t nibbles = 0;
+  };
+
+  static bool Cacheable(const PackedHex &token) {
+    return token.nibbles > 0 && token.nibbles <= 16;
+  }
+
+  static uint64_t Tag(const PackedHex &token) {
+    uint64_t tag = 0;
+    for (size_t i = 0; i < 8; i++) {
+      tag = (tag << 8) | token.bytes[i];
+    }
+    return tag;
+  }
+
+  static size_t SetOf(uint64_t tag, uint8_t nibbles) {
+    return static_cast<size_t>(((tag ^ nibbles) * 0x9E3779B97F4A7C15ull) >> 56) % kSets;
+  }
+
+  std::array<Entry, kSets * kWays> entries_{};
+  uint32_t clock_ = 0;
+  Counters counters_;
+};
+
+struct ConnectionHealth {
+  const char *name = "";
+  bool connected = false;
+  uint64_t connects = 0;
+  uint64_t disconnects = 0;
+  uint32_t failures = 0;
+  uint64_t retry_delay_ms = 0;
+  uint64_t connected_since_ms = 0;
 };
 
+constexpr size_t kMaxEventConnections = 2;
+
 struct AppState {
-  std::vector<Node> nodes;
-  std::unordered_map<int, size_t> node_hash_index;
+  std::shared_ptr<const NodeStore> node_store = std::make_shared<NodeStore>();
+  // Used under the state mutex by whichever thread handles propagation
+  // events: the reactor, or the direct-ingest threads.
+  TokenResolutionCache token_cache;
   std::deque<PacketMessage> packet_messages;
-  std::vector<MovingPulse> pulses;
-  std::vector<PathAnimation> paths;
+  AnimationRing<MovingPulse, kMaxPulses> pulses;
+  PathPool paths;
+  EventAdmission admission;
   std::string connection_status = "Initializing...";
   std::string last_update = "Never";
   int selected_node_index = -1;
   bool animations_enabled = true;
+  uint64_t stream_gaps = 0;
+  std::array<ConnectionHealth, kMaxEventConnections> connections;
+};
+
+// Copied under the state mutex: only live animations, into vectors that keep
+// their capacity across frames.
+struct FrameSnapshot {
+  std::shared_ptr<const NodeStore> node_store;
+  std::deque<PacketMessage> packet_messages;
+  std::vector<MovingPulse> pulses;
+  std::vector<PathAnimation> paths;
+  std::vector<SDL_FPoint> path_points;
+  std::string connection_status;
+  std::string last_update;
+  int selected_node_index = -1;
+  bool animations_enabled = true;
+
+  void CopyFrom(const AppState &state) {
+    node_store = state.node_store;
+    packet_messages = state.packet_messages;
+    state.pulses.CopyTo(&pulses);
+    state.paths.CopyTo(&paths, &path_points);
+    connection_status = state.connection_status;
+    last_update = state.last_update;
+    selected_node_index = state.selected_node_index;
+    animations_enabled = state.animations_enabled;
+  }
 };
 
 class LogSink {
@@ -177,9 +814,10 @@ void LatLonToWorldPixel(double lat, double lon, int zoom, double *out_x, double
   *out_y = tile_y * kTileSize;
 }
 
-bool EnsureDir(const std::string &path) {
-  std::string command = "mkdir -p \"" + path + "\"";
-  return std::system(command.c_str()) == 0;
+bool EnsureDir(const std::filesystem::path &path) {
+  std::error_code error;
+  std::filesystem::create_directories(path, error);
+  return !error;
 }
 
 bool FileExists(const std::string &path) {
@@ -187,283 +825,2457 @@ bool FileExists(const std::string &path) {
   return file.good();
 }
 
-size_t CurlWriteToString(void *contents, size_t size, size_t nmemb, void *userp) {
+size_t CurlWriteToString(char *contents, size_t size, size_t nmemb, void *userp) {
   size_t total = size * nmemb;
   std::string *out = static_cast<std::string *>(userp);
-  out->append(static_cast<char *>(contents), total);
+  out->append(contents, total);
   return total;
 }
 
-std::string HttpGet(const std::string &url) {
-  CURL *curl = curl_easy_init();
-  if (!curl) {
-    return {};
-  }
-  std::string response;
-  curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-  curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
-  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, CurlWriteToString);
-  curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
-  curl_easy_setopt(curl, CURLOPT_USERAGENT, "meshcoretel-native/1.0");
-  CURLcode res = curl_easy_perform(curl);
-  curl_easy_cleanup(curl);
-  if (res != CURLE_OK) {
-    std::cerr << "HTTP GET failed: " << url << " (" << curl_easy_strerror(res) << ")\n";
-    return {};
+void LogTransferSize(const char *what, curl_off_t wire_bytes, size_t body_bytes) {
+  if (body_bytes == 0) {
+    return;
   }
-  return response;
+  double percent = 100.0 * static_cast<double>(wire_bytes) / static_cast<double>(body_bytes);
+  std::cerr << what << ": " << wire_bytes << " bytes on the wire, " << body_bytes
+            << " decoded (" << static_cast<int>(percent + 0.5) << "%)\n";
 }
 
-bool WriteFile(const std::string &path, const std::string &data) {
-  std::ofstream out(path, std::ios::binary);
-  if (!out) {
-    return false;
+// Process-wide DNS cache, connection pool and TLS sessions.
+class CurlShare {
+ public:
+  static CURLSH *Get() { return Instance().share_; }
+
+  // Must run after every attached handle is cleaned up and before
+  // curl_global_cleanup.
+  static void Cleanup() {
+    CurlShare &instance = Instance();
+    if (!instance.share_) {
+      return;
+    }
+    CURLSHcode res = curl_share_cleanup(instance.share_);
+    if (res != CURLSHE_OK) {
+      std::cerr << "curl_share_cleanup failed: " << curl_share_strerror(res) << "\n";
+      return;
+    }
+    instance.share_ = nullptr;
   }
-  out.write(data.data(), static_cast<std::streamsize>(data.size()));
-  return true;
-}
 
-SDL_Texture *LoadTextureFromFile(SDL_Renderer *renderer, const std::string &path, int *w, int *h) {
-  SDL_Surface *surface = IMG_Load(path.c_str());
-  if (!surface) {
-    return nullptr;
+ private:
+  static CurlShare &Instance() {
+    static CurlShare instance;
+    return instance;
   }
-  SDL_Texture *texture = SDL_CreateTextureFromSurface(renderer, surface);
-  if (w) {
-    *w = surface->w;
+
+  CurlShare() : share_(curl_share_init()) {
+    if (!share_) {
+      std::cerr << "curl_share_init failed, connections will not be shared\n";
+      return;
+    }
+    curl_share_setopt(share_, CURLSHOPT_LOCKFUNC, Lock);
+    curl_share_setopt(share_, CURLSHOPT_UNLOCKFUNC, Unlock);
+    curl_share_setopt(share_, CURLSHOPT_USERDATA, this);
+    curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
   }
-  if (h) {
-    *h = surface->h;
+
+  static void Lock(CURL *, curl_lock_data data, curl_lock_access, void *userptr) {
+    static_cast<CurlShare *>(userptr)->locks_[data].lock();
   }
-  SDL_FreeSurface(surface);
-  return texture;
+
+  static void Unlock(CURL *, curl_lock_data data, void *userptr) {
+    static_cast<CurlShare *>(userptr)->locks_[data].unlock();
+  }
+
+  CURLSH *share_;
+  std::array<std::mutex, CURL_LOCK_DATA_LAST> locks_;
+};
+
+std::atomic<uint64_t> g_http_connections_opened{0};
+std::atomic<uint64_t> g_http_connections_reused{0};
+
+void ConfigureSharedHandle(CURL *curl) {
+  curl_easy_setopt(curl, CURLOPT_SHARE, CurlShare::Get());
+  curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
 }
 
-class TileCache {
+// Per-thread easy handle, so keep-alive carries over between transfers.
+class ThreadCurlHandle {
  public:
-  TileCache(SDL_Renderer *renderer, const std::string &cache_root)
-      : renderer_(renderer), cache_root_(cache_root) {}
+  ~ThreadCurlHandle() { Release(); }
 
-  TileTexture GetTile(int zoom, int x, int y) {
-    TileKey key{zoom, x, y};
-    auto it = tiles_.find(key);
-    if (it != tiles_.end()) {
-      return it->second;
+  CURL *Acquire() {
+    if (curl_) {
+      curl_easy_reset(curl_);
+    } else {
+      curl_ = curl_easy_init();
     }
-    TileTexture tex = LoadTile(zoom, x, y);
-    tiles_.emplace(key, tex);
-    return tex;
+    if (curl_) {
+      ConfigureSharedHandle(curl_);
+    }
+    return curl_;
   }
 
-  void Clear() {
-    for (auto &entry : tiles_) {
-      if (entry.second.texture) {
-        SDL_DestroyTexture(entry.second.texture);
-      }
+  void Release() {
+    if (curl_) {
+      curl_easy_cleanup(curl_);
+      curl_ = nullptr;
     }
-    tiles_.clear();
   }
 
  private:
-  TileTexture LoadTile(int zoom, int x, int y) {
-    TileTexture tex;
-    std::ostringstream dir;
-    dir << cache_root_ << "/" << zoom << "/" << x;
-    EnsureDir(dir.str());
+  CURL *curl_ = nullptr;
+};
 
-    std::ostringstream path;
-    path << dir.str() << "/" << y << ".png";
+thread_local ThreadCurlHandle t_curl;
 
-    if (!FileExists(path.str())) {
-      std::ostringstream url;
-      url << "https://a.tile.openstreetmap.org/" << zoom << "/" << x << "/" << y << ".png";
-      std::string data = HttpGet(url.str());
-      if (!data.empty()) {
-        WriteFile(path.str(), data);
-      }
-    }
+void CountConnectionReuse(CURL *curl) {
+  long opened = 0;
+  if (curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &opened) != CURLE_OK) {
+    return;
+  }
+  if (opened > 0) {
+    g_http_connections_opened.fetch_add(1, std::memory_order_relaxed);
+  } else {
+    g_http_connections_reused.fetch_add(1, std::memory_order_relaxed);
+  }
+}
 
-    tex.texture = LoadTextureFromFile(renderer_, path.str(), &tex.width, &tex.height);
-    return tex;
+// MESHCORETEL_SERVER_URL is an http(s) base URL or unix:///path/to.sock.
+struct ServerEndpoint {
+  std::string base_url;
+  std::string unix_socket;
+
+  static ServerEndpoint Parse(const std::string &url) {
+    constexpr std::string_view kUnixScheme = "unix://";
+    ServerEndpoint endpoint;
+    if (url.compare(0, kUnixScheme.size(), kUnixScheme) == 0) {
+      // The host part is only sent in the Host header.
+      endpoint.base_url = "http://localhost";
+      endpoint.unix_socket = url.substr(kUnixScheme.size());
+    } else {
+      endpoint.base_url = url;
+    }
+    return endpoint;
+  }
+
+  std::string Describe() const {
+    return unix_socket.empty() ? base_url : "unix://" + unix_socket;
+  }
+};
+
+void ApplyServerEndpoint(CURL *curl, const ServerEndpoint &endpoint) {
+  curl_easy_setopt(curl, CURLOPT_UNIX_SOCKET_PATH,
+                   endpoint.unix_socket.empty() ? nullptr : endpoint.unix_socket.c_str());
+}
+
+struct HttpExchange {
+  const ServerEndpoint *endpoint = nullptr;
+  std::vector<std::string> request_headers;
+  // Headers of the final response, names lower-cased.
+  std::unordered_map<std::string, std::string> response_headers;
+  long status = 0;
+  curl_off_t wire_bytes = 0;
+
+  std::string Header(const std::string &name) const {
+    auto it = response_headers.find(name);
+    return it == response_headers.end() ? std::string() : it->second;
+  }
+};
+
+size_t CurlCollectHeader(char *buffer, size_t size, size_t nitems, void *userp) {
+  size_t total = size * nitems;
+  auto *headers = static_cast<std::unordered_map<std::string, std::string> *>(userp);
+  std::string_view line(buffer, total);
+  if (line.rfind("HTTP/", 0) == 0) {
+    // Status line of a new response (redirect or 100-continue): start over.
+    headers->clear();
+    return total;
+  }
+  size_t colon = line.find(':');
+  if (colon == std::string_view::npos) {
+    return total;
+  }
+  std::string name(line.substr(0, colon));
+  std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+  std::string_view value = line.substr(colon + 1);
+  while (!value.empty() && (value.front() == ' ' || value.front() == '\t')) {
+    value.remove_prefix(1);
+  }
+  while (!value.empty() && (value.back() == '\r' || value.back() == '\n' || value.back() == ' ')) {
+    value.remove_suffix(1);
+  }
+  (*headers)[name] = std::string(value);
+  return total;
+}
+
+// libcurl decodes every encoding it was built with, so write_fn always sees
+// the identity body. The returned list must be passed to FinishHttpGet.
+curl_slist *PrepareHttpGet(CURL *curl, const std::string &url, curl_write_callback write_fn,
+                           void *userdata, HttpExchange *exchange) {
+  curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+  curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_fn);
+  curl_easy_setopt(curl, CURLOPT_WRITEDATA, userdata);
+  curl_easy_setopt(curl, CURLOPT_USERAGENT, "meshcoretel-native/1.0");
+  curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
+  curl_slist *headers = nullptr;
+  if (exchange) {
+    for (const std::string &header : exchange->request_headers) {
+      headers = curl_slist_append(headers, header.c_str());
+    }
+    exchange->response_headers.clear();
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, CurlCollectHeader);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, &exchange->response_headers);
+    if (exchange->endpoint) {
+      ApplyServerEndpoint(curl, *exchange->endpoint);
+    }
+  }
+  return headers;
+}
+
+void FinishHttpGet(CURL *curl, HttpExchange *exchange, curl_slist *headers) {
+  CountConnectionReuse(curl);
+  if (exchange) {
+    exchange->status = 0;
+    exchange->wire_bytes = 0;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &exchange->status);
+    curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &exchange->wire_bytes);
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, nullptr);
+  }
+  curl_slist_free_all(headers);
+}
+
+bool WriteFile(const std::string &path, const std::string &data) {
+  std::ofstream out(path, std::ios::binary);
+  if (!out) {
+    return false;
+  }
+  out.write(data.data(), static_cast<std::streamsize>(data.size()));
+  return true;
+}
+
+SDL_Texture *LoadTextureFromFile(SDL_Renderer *renderer, const std::string &path, int *w, int *h) {
+  SDL_Surface *surface = IMG_Load(path.c_str());
+  if (!surface) {
+    return nullptr;
+  }
+  SDL_Texture *texture = SDL_CreateTextureFromSurface(renderer, surface);
+  if (w) {
+    *w = surface->w;
+  }
+  if (h) {
+    *h = surface->h;
+  }
+  SDL_FreeSurface(surface);
+  return texture;
+}
+
+// Timers hash into kSlots buckets by due tick; timers more than a revolution
+// out wait in their bucket until it comes round.
+class TimerWheel {
+ public:
+  using Callback = std::function<void()>;
+  static constexpr uint64_t kTickMs = 10;
+  static constexpr size_t kSlots = 256;
+
+  explicit TimerWheel(uint64_t now_ms) : tick_(now_ms / kTickMs) {}
+
+  uint64_t Schedule(uint64_t now_ms, uint64_t delay_ms, Callback callback) {
+    // Rounded up so timers never fire early, and never into a tick that
+    // has already been processed.
+    uint64_t due = std::max((now_ms + delay_ms + kTickMs - 1) / kTickMs, tick_);
+    uint64_t id = ++last_id_;
+    slots_[due % kSlots].push_back(Timer{id, due, std::move(callback)});
+    due_ticks_.emplace(id, due);
+    return id;
+  }
+
+  void Cancel(uint64_t id) {
+    auto it = due_ticks_.find(id);
+    if (it == due_ticks_.end()) {
+      return;
+    }
+    std::vector<Timer> &slot = slots_[it->second % kSlots];
+    slot.erase(std::remove_if(slot.begin(), slot.end(),
+                              [id](const Timer &timer) { return timer.id == id; }),
+               slot.end());
+    due_ticks_.erase(it);
+  }
+
+  // Runs every timer due by now_ms. Callbacks may schedule and cancel.
+  void Advance(uint64_t now_ms) {
+    uint64_t now_tick = now_ms / kTickMs;
+    if (due_ticks_.empty()) {
+      tick_ = std::max(tick_, now_tick + 1);
+      return;
+    }
+    while (tick_ <= now_tick) {
+      std::vector<Timer> &slot = slots_[tick_ % kSlots];
+      due_.clear();
+      for (size_t i = 0; i < slot.size();) {
+        if (slot[i].due <= tick_) {
+          due_.push_back(std::move(slot[i]));
+          slot[i] = std::move(slot.back());
+          slot.pop_back();
+        } else {
+          i++;
+        }
+      }
+      tick_++;
+      for (Timer &timer : due_) {
+        due_ticks_.erase(timer.id);
+      }
+      for (Timer &timer : due_) {
+        timer.callback();
+      }
+    }
+  }
+
+  int NextTimeoutMs(uint64_t now_ms) const {
+    if (due_ticks_.empty()) {
+      return -1;
+    }
+    uint64_t next = UINT64_MAX;
+    for (const auto &entry : due_ticks_) {
+      next = std::min(next, entry.second);
+    }
+    uint64_t due_ms = next * kTickMs;
+    return due_ms <= now_ms ? 0 : static_cast<int>(std::min<uint64_t>(due_ms - now_ms, INT32_MAX));
+  }
+
+ private:
+  struct Timer {
+    uint64_t id;
+    uint64_t due;
+    Callback callback;
+  };
+
+  uint64_t tick_;
+  uint64_t last_id_ = 0;
+  std::array<std::vector<Timer>, kSlots> slots_;
+  std::unordered_map<uint64_t, uint64_t> due_ticks_;
+  std::vector<Timer> due_;
+};
+
+// epoll-driven curl_multi loop. Transfers, timers and their callbacks belong
+// to the reactor thread; other threads hand work over with Post().
+class NetworkReactor {
+ public:
+  using Task = std::function<void()>;
+  using TransferDone = std::function<void(CURLcode)>;
+
+  NetworkReactor() : wheel_(NowMs()) {}
+
+  ~NetworkReactor() {
+    Stop();
+    if (multi_) {
+      curl_multi_cleanup(multi_);
+    }
+    if (epoll_fd_ >= 0) {
+      close(epoll_fd_);
+    }
+    if (wake_fd_ >= 0) {
+      close(wake_fd_);
+    }
+  }
+
+  bool Start() {
+    multi_ = curl_multi_init();
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (!multi_ || epoll_fd_ < 0 || wake_fd_ < 0) {
+      std::cerr << "Network reactor init failed: " << std::strerror(errno) << "\n";
+      return false;
+    }
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.fd = wake_fd_;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &event);
+    curl_multi_setopt(multi_, CURLMOPT_SOCKETFUNCTION, OnSocket);
+    curl_multi_setopt(multi_, CURLMOPT_SOCKETDATA, this);
+    curl_multi_setopt(multi_, CURLMOPT_TIMERFUNCTION, OnTimer);
+    curl_multi_setopt(multi_, CURLMOPT_TIMERDATA, this);
+    thread_ = std::thread(&NetworkReactor::Run, this);
+    return true;
+  }
+
+  // Transfers still running are abandoned; their owners clean up the handles.
+  void Stop() {
+    if (!thread_.joinable()) {
+      return;
+    }
+    stopping_ = true;
+    Wake();
+    thread_.join();
+    curl_multi_cleanup(multi_);
+    multi_ = nullptr;
+  }
+
+  // Any thread. Tasks posted to a reactor that failed to start never run.
+  void Post(Task task) {
+    {
+      std::lock_guard<std::mutex> lock(posted_mutex_);
+      posted_.push_back(std::move(task));
+    }
+    Wake();
+  }
+
+  // Reactor thread only. `done` runs once the transfer ends, after the
+  // handle has been detached again, so it may start the next transfer.
+  void AddTransfer(CURL *curl, TransferDone done) {
+    CURLMcode rc = curl_multi_add_handle(multi_, curl);
+    if (rc != CURLM_OK) {
+      std::cerr << "curl_multi_add_handle failed: " << curl_multi_strerror(rc) << "\n";
+      Schedule(0, [done = std::move(done)]() { done(CURLE_FAILED_INIT); });
+      return;
+    }
+    transfers_[curl] = std::move(done);
+  }
+
+  // Reactor thread only.
+  uint64_t Schedule(uint64_t delay_ms, Task task) {
+    return wheel_.Schedule(NowMs(), delay_ms, std::move(task));
+  }
+
+ private:
+  static int OnSocket(CURL *, curl_socket_t socket, int what, void *userp, void *) {
+    auto *self = static_cast<NetworkReactor *>(userp);
+    if (what == CURL_POLL_REMOVE) {
+      epoll_ctl(self->epoll_fd_, EPOLL_CTL_DEL, socket, nullptr);
+      return 0;
+    }
+    epoll_event event{};
+    event.events = ((what & CURL_POLL_IN) ? EPOLLIN : 0u) | ((what & CURL_POLL_OUT) ? EPOLLOUT : 0u);
+    event.data.fd = socket;
+    if (epoll_ctl(self->epoll_fd_, EPOLL_CTL_MOD, socket, &event) != 0 && errno == ENOENT) {
+      epoll_ctl(self->epoll_fd_, EPOLL_CTL_ADD, socket, &event);
+    }
+    return 0;
+  }
+
+  static int OnTimer(CURLM *, long timeout_ms, void *userp) {
+    auto *self = static_cast<NetworkReactor *>(userp);
+    if (self->curl_timer_) {
+      self->wheel_.Cancel(self->curl_timer_);
+      self->curl_timer_ = 0;
+    }
+    // 0 means "as soon as possible", which a wheel tick would delay.
+    self->curl_timeout_now_ = timeout_ms == 0;
+    if (timeout_ms > 0) {
+      self->curl_timer_ = self->Schedule(static_cast<uint64_t>(timeout_ms), [self]() {
+        self->curl_timer_ = 0;
+        self->SocketAction(CURL_SOCKET_TIMEOUT, 0);
+      });
+    }
+    return 0;
+  }
+
+  void Wake() {
+    if (wake_fd_ < 0) {
+      return;
+    }
+    uint64_t one = 1;
+    if (write(wake_fd_, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+      std::cerr << "Network reactor wakeup failed: " << std::strerror(errno) << "\n";
+    }
+  }
+
+  void Run() {
+    std::array<epoll_event, 32> events;
+    while (!stopping_) {
+      int timeout = curl_timeout_now_ ? 0 : wheel_.NextTimeoutMs(NowMs());
+      int count = epoll_wait(epoll_fd_, events.data(), static_cast<int>(events.size()), timeout);
+      if (count < 0 && errno != EINTR) {
+        std::cerr << "epoll_wait failed: " << std::strerror(errno) << "\n";
+        break;
+      }
+      for (int i = 0; i < count; i++) {
+        int fd = events[i].data.fd;
+        if (fd == wake_fd_) {
+          uint64_t value = 0;
+          while (read(wake_fd_, &value, sizeof(value)) > 0) {
+          }
+          continue;
+        }
+        int flags = 0;
+        flags |= (events[i].events & EPOLLIN) ? CURL_CSELECT_IN : 0;
+        flags |= (events[i].events & EPOLLOUT) ? CURL_CSELECT_OUT : 0;
+        flags |= (events[i].events & (EPOLLERR | EPOLLHUP)) ? CURL_CSELECT_ERR : 0;
+        SocketAction(fd, flags);
+      }
+      if (curl_timeout_now_) {
+        curl_timeout_now_ = false;
+        SocketAction(CURL_SOCKET_TIMEOUT, 0);
+      }
+      RunPosted();
+      Guarded([this]() { wheel_.Advance(NowMs()); });
+    }
+    for (auto &transfer : transfers_) {
+      curl_multi_remove_handle(multi_, transfer.first);
+    }
+    transfers_.clear();
+  }
+
+  void RunPosted() {
+    std::vector<Task> tasks;
+    {
+      std::lock_guard<std::mutex> lock(posted_mutex_);
+      tasks.swap(posted_);
+    }
+    for (Task &task : tasks) {
+      Guarded(task);
+    }
+  }
+
+  void SocketAction(curl_socket_t socket, int flags) {
+    int running = 0;
+    Guarded([&]() { curl_multi_socket_action(multi_, socket, flags, &running); });
+    int queued = 0;
+    while (CURLMsg *message = curl_multi_info_read(multi_, &queued)) {
+      if (message->msg != CURLMSG_DONE) {
+        continue;
+      }
+      CURL *curl = message->easy_handle;
+      CURLcode result = message->data.result;
+      curl_multi_remove_handle(multi_, curl);
+      auto it = transfers_.find(curl);
+      if (it == transfers_.end()) {
+        continue;
+      }
+      TransferDone done = std::move(it->second);
+      transfers_.erase(it);
+      Guarded([&]() { done(result); });
+    }
+  }
+
+  static void Guarded(const Task &task) {
+    try {
+      task();
+    } catch (const std::exception &e) {
+      std::cerr << "Network reactor error: " << e.what() << "\n";
+    } catch (...) {
+      std::cerr << "Network reactor error: unknown exception\n";
+    }
+  }
+
+  CURLM *multi_ = nullptr;
+  int epoll_fd_ = -1;
+  int wake_fd_ = -1;
+  std::thread thread_;
+  std::atomic<bool> stopping_{false};
+  std::mutex posted_mutex_;
+  std::vector<Task> posted_;
+  TimerWheel wheel_;
+  uint64_t curl_timer_ = 0;
+  bool curl_timeout_now_ = false;
+  std::unordered_map<CURL *, TransferDone> transfers_;
+};
+
+// Runs posted tasks in order, off the reactor: adverts parsing and tile writes.
+class TaskThread {
+ public:
+  using Task = std::function<void()>;
+
+  TaskThread() : thread_([this]() { Run(); }) {}
+
+  ~TaskThread() { Stop(); }
+
+  // Any thread. Tasks posted after Stop() are dropped.
+  void Post(Task task) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (stopping_) {
+        return;
+      }
+      tasks_.push_back(std::move(task));
+    }
+    wake_.notify_one();
+  }
+
+  // Lets the running task finish and drops the queued ones.
+  void Stop() {
+    std::deque<Task> dropped;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+      dropped.swap(tasks_);
+    }
+    wake_.notify_one();
+    if (thread_.joinable()) {
+      thread_.join();
+    }
+  }
+
+ private:
+  void Run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      wake_.wait(lock, [this]() { return stopping_ || !tasks_.empty(); });
+      if (stopping_) {
+        return;
+      }
+      Task task = std::move(tasks_.front());
+      tasks_.pop_front();
+      lock.unlock();
+      try {
+        task();
+      } catch (const std::exception &e) {
+        std::cerr << "Background task error: " << e.what() << "\n";
+      } catch (...) {
+        std::cerr << "Background task error: unknown exception\n";
+      }
+      lock.lock();
+    }
+  }
+
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::deque<Task> tasks_;
+  bool stopping_ = false;
+  // Last, so the members above exist before Run() starts.
+  std::thread thread_;
+};
+
+Uint32 g_network_event_type = static_cast<Uint32>(-1);
+
+enum NetworkEventCode : Sint32 {
+  // For both, user.data1 is a heap-allocated TileKey the handler deletes.
+  kTileReady = 1,
+  kTileDropped = 2,
+};
+
+// At most kMaxDownloads at once, per the OSM tile usage policy, newest request
+// first. Each request ends in kTileReady, sent once the file is written, or
+// kTileDropped when it falls off the queue.
+class TileDownloader {
+ public:
+  static constexpr size_t kMaxDownloads = 2;
+  static constexpr size_t kMaxQueued = 32;
+
+  TileDownloader(NetworkReactor *reactor, TaskThread *worker)
+      : reactor_(reactor), worker_(worker) {}
+
+  ~TileDownloader() {
+    for (Slot &slot : slots_) {
+      curl_slist_free_all(slot.headers);
+      if (slot.curl) {
+        curl_easy_cleanup(slot.curl);
+      }
+    }
+  }
+
+  // Any thread.
+  void Request(const TileKey &key, std::string url, std::string path) {
+    reactor_->Post([this, job = Job{key, std::move(url), std::move(path)}]() mutable {
+      queue_.push_back(std::move(job));
+      if (queue_.size() > kMaxQueued) {
+        Announce(kTileDropped, queue_.front().key);
+        queue_.pop_front();
+      }
+      Pump();
+    });
+  }
+
+ private:
+  struct Job {
+    TileKey key;
+    std::string url;
+    std::string path;
+  };
+
+  struct Slot {
+    CURL *curl = nullptr;
+    bool busy = false;
+    Job job;
+    std::string data;
+    HttpExchange exchange;
+    curl_slist *headers = nullptr;
+  };
+
+  void Pump() {
+    for (Slot &slot : slots_) {
+      if (queue_.empty()) {
+        return;
+      }
+      if (slot.busy) {
+        continue;
+      }
+      if (slot.curl) {
+        curl_easy_reset(slot.curl);
+      } else if (!(slot.curl = curl_easy_init())) {
+        return;
+      }
+      ConfigureSharedHandle(slot.curl);
+      slot.busy = true;
+      slot.job = std::move(queue_.back());
+      queue_.pop_back();
+      slot.data.clear();
+      slot.headers = PrepareHttpGet(slot.curl, slot.job.url, CurlWriteToString, &slot.data,
+                                    &slot.exchange);
+      Slot *target = &slot;
+      reactor_->AddTransfer(slot.curl, [this, target](CURLcode res) { Finished(target, res); });
+    }
+  }
+
+  void Finished(Slot *slot, CURLcode res) {
+    FinishHttpGet(slot->curl, &slot->exchange, slot->headers);
+    slot->headers = nullptr;
+    slot->busy = false;
+    if (res != CURLE_OK) {
+      std::cerr << "HTTP GET failed: " << slot->job.url << " (" << curl_easy_strerror(res)
+                << ")\n";
+    } else if (slot->exchange.status != 200) {
+      std::cerr << "HTTP GET failed: " << slot->job.url << " (HTTP " << slot->exchange.status
+                << ")\n";
+    } else {
+      worker_->Post([key = slot->job.key, path = std::move(slot->job.path),
+                     data = std::move(slot->data)]() {
+        if (EnsureDir(std::filesystem::path(path).parent_path())) {
+          WriteFile(path, data);
+        }
+        Announce(kTileReady, key);
+      });
+      Pump();
+      return;
+    }
+    Announce(kTileReady, slot->job.key);
+    Pump();
+  }
+
+  static void Announce(NetworkEventCode code, const TileKey &tile) {
+    SDL_Event event{};
+    event.type = g_network_event_type;
+    event.user.code = code;
+    auto *key = new TileKey(tile);
+    event.user.data1 = key;
+    if (SDL_PushEvent(&event) != 1) {
+      delete key;
+    }
+  }
+
+  NetworkReactor *reactor_;
+  TaskThread *worker_;
+  std::deque<Job> queue_;
+  std::array<Slot, kMaxDownloads> slots_;
+};
+
+// Missing tiles draw empty until OnTileDownloaded; failed ones until Clear().
+class TileCache {
+ public:
+  TileCache(SDL_Renderer *renderer, const std::string &cache_root, TileDownloader *downloader)
+      : renderer_(renderer), cache_root_(cache_root), downloader_(downloader) {}
+
+  TileTexture GetTile(int zoom, int x, int y) {
+    TileKey key{zoom, x, y};
+    auto it = tiles_.find(key);
+    if (it != tiles_.end()) {
+      return it->second;
+    }
+    if (pending_.count(key)) {
+      return {};
+    }
+    std::string path = TilePath(key);
+    if (!FileExists(path)) {
+      if (!downloader_) {
+        tiles_.emplace(key, TileTexture{});
+        return {};
+      }
+      std::ostringstream url;
+      url << "https://a.tile.openstreetmap.org/" << zoom << "/" << x << "/" << y << ".png";
+      pending_.insert(key);
+      downloader_->Request(key, url.str(), path);
+      return {};
+    }
+    TileTexture tex = LoadTile(path);
+    tiles_.emplace(key, tex);
+    return tex;
+  }
+
+  void OnTileDownloaded(const TileKey &key) {
+    if (pending_.erase(key) == 0) {
+      return;
+    }
+    tiles_.emplace(key, LoadTile(TilePath(key)));
+  }
+
+  void OnTileDropped(const TileKey &key) { pending_.erase(key); }
+
+  void Clear() {
+    for (auto &entry : tiles_) {
+      if (entry.second.texture) {
+        SDL_DestroyTexture(entry.second.texture);
+      }
+    }
+    tiles_.clear();
+    pending_.clear();
+  }
+
+ private:
+  std::string TilePath(const TileKey &key) const {
+    std::ostringstream path;
+    path << cache_root_ << "/" << key.z << "/" << key.x << "/" << key.y << ".png";
+    return path.str();
+  }
+
+  TileTexture LoadTile(const std::string &path) {
+    TileTexture tex;
+    tex.texture = LoadTextureFromFile(renderer_, path, &tex.width, &tex.height);
+    return tex;
   }
 
   SDL_Renderer *renderer_ = nullptr;
   std::string cache_root_;
+  TileDownloader *downloader_ = nullptr;
   std::unordered_map<TileKey, TileTexture, TileKeyHash, TileKeyEq> tiles_;
+  std::unordered_set<TileKey, TileKeyHash, TileKeyEq> pending_;
+};
+
+bool LooksLikeJsonObject(std::string_view input) {
+  for (char c : input) {
+    if (c == ' ' || c == '\n' || c == '\r' || c == '\t') {
+      continue;
+    }
+    return c == '{';
+  }
+  return false;
+}
+
+size_t SkipJsonWhitespace(std::string_view in, size_t pos) {
+  while (pos < in.size() && (in[pos] == ' ' || in[pos] == '\t' || in[pos] == '\r' || in[pos] == '\n')) {
+    pos++;
+  }
+  return pos;
+}
+
+// `pos` is the opening quote; returns the offset just past the closing quote.
+size_t SkipJsonString(std::string_view in, size_t pos) {
+  pos++;
+  while (pos < in.size()) {
+    const void *quote = std::memchr(in.data() + pos, '"', in.size() - pos);
+    if (!quote) {
+      return std::string_view::npos;
+    }
+    size_t at = static_cast<size_t>(static_cast<const char *>(quote) - in.data());
+    size_t backslashes = 0;
+    while (at - backslashes > pos && in[at - backslashes - 1] == '\\') {
+      backslashes++;
+    }
+    if (backslashes % 2 == 0) {
+      return at + 1;
+    }
+    pos = at + 1;
+  }
+  return std::string_view::npos;
+}
+
+// Skips one value of any type without materializing it. Returns npos when
+// there is no value at pos, so callers looping over values always advance.
+size_t SkipJsonValue(std::string_view in, size_t pos) {
+  if (pos >= in.size()) {
+    return std::string_view::npos;
+  }
+  if (in[pos] == '"') {
+    return SkipJsonString(in, pos);
+  }
+  if (in[pos] == '{' || in[pos] == '[') {
+    int depth = 0;
+    while (pos < in.size()) {
+      char c = in[pos];
+      if (c == '"') {
+        pos = SkipJsonString(in, pos);
+        if (pos == std::string_view::npos) {
+          return pos;
+        }
+        continue;
+      }
+      if (c == '{' || c == '[') {
+        depth++;
+      } else if (c == '}' || c == ']') {
+        if (--depth == 0) {
+          return pos + 1;
+        }
+      }
+      pos++;
+    }
+    return std::string_view::npos;
+  }
+  size_t start = pos;
+  while (pos < in.size() && in[pos] != ',' && in[pos] != '}' && in[pos] != ']' &&
+         in[pos] != ' ' && in[pos] != '\t' && in[pos] != '\r' && in[pos] != '\n') {
+    pos++;
+  }
+  return pos == start ? std::string_view::npos : pos;
+}
+
+void AppendUtf8(uint32_t cp, std::string *out) {
+  if (cp < 0x80) {
+    out->push_back(static_cast<char>(cp));
+  } else if (cp < 0x800) {
+    out->push_back(static_cast<char>(0xC0 | (cp >> 6)));
+    out->push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+  } else if (cp < 0x10000) {
+    out->push_back(static_cast<char>(0xE0 | (cp >> 12)));
+    out->push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+    out->push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+  } else {
+    out->push_back(static_cast<char>(0xF0 | (cp >> 18)));
+    out->push_back(static_cast<char>(0x80 | ((cp >> 12) & 0x3F)));
+    out->push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+    out->push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+  }
+}
+
+bool ParseHex4(std::string_view in, size_t pos, uint32_t *out) {
+  if (pos + 4 > in.size()) {
+    return false;
+  }
+  uint32_t value = 0;
+  for (size_t i = pos; i < pos + 4; i++) {
+    char c = in[i];
+    value <<= 4;
+    if (c >= '0' && c <= '9') {
+      value |= static_cast<uint32_t>(c - '0');
+    } else if (c >= 'a' && c <= 'f') {
+      value |= static_cast<uint32_t>(c - 'a' + 10);
+    } else if (c >= 'A' && c <= 'F') {
+      value |= static_cast<uint32_t>(c - 'A' + 10);
+    } else {
+      return false;
+    }
+  }
+  *out = value;
+  return true;
+}
+
+// Appends the decoded body of a string literal (without quotes) to `out`.
+bool AppendUnescapedJson(std::string_view raw, std::string *out) {
+  size_t pos = 0;
+  while (pos < raw.size()) {
+    const void *slash = std::memchr(raw.data() + pos, '\\', raw.size() - pos);
+    size_t run_end = slash ? static_cast<size_t>(static_cast<const char *>(slash) - raw.data())
+                           : raw.size();
+    out->append(raw.data() + pos, run_end - pos);
+    if (!slash) {
+      break;
+    }
+    if (run_end + 1 >= raw.size()) {
+      return false;
+    }
+    char c = raw[run_end + 1];
+    pos = run_end + 2;
+    switch (c) {
+      case '"': out->push_back('"'); break;
+      case '\\': out->push_back('\\'); break;
+      case '/': out->push_back('/'); break;
+      case 'b': out->push_back('\b'); break;
+      case 'f': out->push_back('\f'); break;
+      case 'n': out->push_back('\n'); break;
+      case 'r': out->push_back('\r'); break;
+      case 't': out->push_back('\t'); break;
+      case 'u': {
+        uint32_t cp = 0;
+        if (!ParseHex4(raw, pos, &cp)) {
+          return false;
+        }
+        pos += 4;
+        if (cp >= 0xD800 && cp <= 0xDBFF) {
+          uint32_t low = 0;
+          if (pos + 6 <= raw.size() && raw[pos] == '\\' && raw[pos + 1] == 'u' &&
+              ParseHex4(raw, pos + 2, &low) && low >= 0xDC00 && low <= 0xDFFF) {
+            cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+            pos += 6;
+          } else {
+            cp = 0xFFFD;
+          }
+        } else if (cp >= 0xDC00 && cp <= 0xDFFF) {
+          cp = 0xFFFD;
+        }
+        AppendUtf8(cp, out);
+        break;
+      }
+      default:
+        return false;
+    }
+  }
+  return true;
+}
+
+bool UnescapeJsonInto(std::string_view raw, std::string *out) {
+  out->clear();
+  return AppendUnescapedJson(raw, out);
+}
+
+// Seeded FNV-1a, usable at compile time. FNV's low bits only depend on the
+// low bits of its state, so the result is folded before it is masked to a
+// slot; otherwise most seeds would give the same slot layout.
+constexpr uint32_t SeededKeyHash(std::string_view key, uint32_t seed) {
+  uint32_t hash = 2166136261u ^ seed;
+  for (char c : key) {
+    hash ^= static_cast<uint8_t>(c);
+    hash *= 16777619u;
+  }
+  hash ^= hash >> 16;
+  hash *= 0x7feb352du;
+  return hash ^ (hash >> 15);
+}
+
+// Compile-time perfect hash over a fixed key set: Find is one hash, one load
+// and one compare, and returns the key's index or -1.
+template <size_t N, size_t Slots>
+class PerfectKeyTable {
+  static_assert((Slots & (Slots - 1)) == 0 && Slots >= N, "Slots must be a power of two >= N");
+
+ public:
+  constexpr explicit PerfectKeyTable(const std::array<std::string_view, N> &keys) : keys_(keys) {
+    while (!TryFill()) {
+      seed_++;
+    }
+  }
+
+  constexpr int Find(std::string_view key) const {
+    int index = slots_[SeededKeyHash(key, seed_) & (Slots - 1)];
+    return index >= 0 && keys_[static_cast<size_t>(index)] == key ? index : -1;
+  }
+
+ private:
+  constexpr bool TryFill() {
+    for (size_t slot = 0; slot < Slots; slot++) {
+      slots_[slot] = -1;
+    }
+    for (size_t i = 0; i < N; i++) {
+      size_t slot = SeededKeyHash(keys_[i], seed_) & (Slots - 1);
+      if (slots_[slot] >= 0) {
+        return false;
+      }
+      slots_[slot] = static_cast<int8_t>(i);
+    }
+    return true;
+  }
+
+  std::array<std::string_view, N> keys_;
+  std::array<int8_t, Slots> slots_{};
+  uint32_t seed_ = 1;
+};
+
+// Payload fields the handlers read; strings live back to back in `text`.
+struct DecodedEvent {
+  enum Field {
+    kType,
+    kDirection,
+    kSenderName,
+    kGroupSenderName,
+    kAdvertName,
+    kOrigin,
+    kSrcHash,
+    kDstHash,
+    kFieldCount
+  };
+
+  struct Value {
+    enum class Kind : uint8_t { kMissing, kString, kNumber, kOther };
+    Kind kind = Kind::kMissing;
+    int64_t number = 0;
+    // The number before truncation, for coordinates.
+    double real = 0.0;
+    uint32_t offset = 0;
+    uint32_t length = 0;
+  };
+
+  std::array<Value, kFieldCount> fields;
+  bool has_path_nodes = false;
+  // Element count of path.nodes, including elements beyond path_nodes.
+  size_t path_node_total = 0;
+  size_t path_node_count = 0;
+  std::array<Value, kMaxPathHops> path_nodes;
+  // Server-resolved hops (?enrich=1), parallel to path.nodes, null where unknown.
+  enum HopArray { kHopIds, kHopLats, kHopLons, kHopArrayCount };
+  std::array<size_t, kHopArrayCount> hop_counts{};
+  std::array<std::array<Value, kMaxPathHops>, kHopArrayCount> hops;
+  std::string text;
+
+  void Clear() {
+    fields.fill(Value{});
+    has_path_nodes = false;
+    path_node_total = 0;
+    path_node_count = 0;
+    hop_counts.fill(0);
+    text.clear();
+  }
+
+  void AppendPathValue(int array, const Value &value) {
+    if (array == kHopArrayCount) {
+      if (path_node_count < path_nodes.size()) {
+        path_nodes[path_node_count++] = value;
+      }
+      path_node_total++;
+    } else if (hop_counts[array] < kMaxPathHops) {
+      hops[array][hop_counts[array]++] = value;
+    }
+  }
+
+  bool HasResolvedHops() const {
+    return path_node_count > 0 && path_node_count == path_node_total &&
+           hop_counts[kHopIds] == path_node_count && hop_counts[kHopLats] == path_node_count &&
+           hop_counts[kHopLons] == path_node_count;
+  }
+
+  Value StoreString(std::string_view value) {
+    Value out;
+    out.kind = Value::Kind::kString;
+    out.offset = static_cast<uint32_t>(text.size());
+    out.length = static_cast<uint32_t>(value.size());
+    text.append(value.data(), value.size());
+    return out;
+  }
+
+  bool StoreRawString(std::string_view raw, Value *out) {
+    if (std::memchr(raw.data(), '\\', raw.size()) == nullptr) {
+      *out = StoreString(raw);
+      return true;
+    }
+    out->kind = Value::Kind::kString;
+    out->offset = static_cast<uint32_t>(text.size());
+    if (!AppendUnescapedJson(raw, &text)) {
+      return false;
+    }
+    out->length = static_cast<uint32_t>(text.size() - out->offset);
+    return true;
+  }
+
+  std::string_view String(const Value &value) const {
+    if (value.kind != Value::Kind::kString) {
+      return {};
+    }
+    return std::string_view(text).substr(value.offset, value.length);
+  }
+
+  std::string_view GetString(Field field) const { return String(fields[field]); }
+};
+
+// Keys of the event schema in DecodedEvent::Field order, then "path".
+constexpr std::array<std::string_view, DecodedEvent::kFieldCount + 1> kEventKeys = {
+  "type", "direction", "sender_name", "group_sender_name", "advert_name",
+  "origin", "src_hash", "dst_hash", "path",
+};
+constexpr int kEventPathKey = DecodedEvent::kFieldCount;
+constexpr PerfectKeyTable<kEventKeys.size(), 16> kEventKeyTable(kEventKeys);
+static_assert(kEventKeyTable.Find("dst_hash") == DecodedEvent::kDstHash, "event key table");
+static_assert(kEventKeyTable.Find("nodes") == -1, "event key table");
+
+int LookupEventField(std::string_view key) {
+  return kEventKeyTable.Find(key);
+}
+
+// Arrays read from the path object, in DecodedEvent::HopArray order, then
+// "nodes".
+constexpr std::array<std::string_view, DecodedEvent::kHopArrayCount + 1> kPathArrayKeys = {
+  "hop_ids", "hop_lats", "hop_lons", "nodes",
+};
+constexpr PerfectKeyTable<kPathArrayKeys.size(), 8> kPathArrayKeyTable(kPathArrayKeys);
+static_assert(kPathArrayKeyTable.Find("nodes") == DecodedEvent::kHopArrayCount, "path key table");
+
+int LookupPathArray(std::string_view key) {
+  return kPathArrayKeyTable.Find(key);
+}
+
+// Keeps only DecodedEvent's fields and path.nodes; no DOM is built.
+class EventSaxHandler {
+ public:
+  explicit EventSaxHandler(DecodedEvent *out) : out_(out) {}
+
+  bool null() { return Scalar(DecodedEvent::Value{}); }
+  bool boolean(bool) { return Scalar(Other()); }
+  bool number_integer(json::number_integer_t value) { return Scalar(Number(value)); }
+  bool number_unsigned(json::number_unsigned_t value) {
+    return Scalar(Number(static_cast<int64_t>(value)));
+  }
+  bool number_float(json::number_float_t value, const json::string_t &) {
+    DecodedEvent::Value out = Number(static_cast<int64_t>(value));
+    out.real = value;
+    return Scalar(out);
+  }
+  bool string(json::string_t &value) {
+    if (!Wanted()) {
+      return Scalar(Other());
+    }
+    return Scalar(out_->StoreString(value));
+  }
+  bool binary(json::binary_t &) { return Scalar(Other()); }
+
+  bool start_object(std::size_t) {
+    if (depth_ == 0) {
+      root_is_object_ = true;
+    } else if (depth_ == 1 && top_field_ == kEventPathKey) {
+      in_path_ = true;
+    } else {
+      Scalar(Other());
+    }
+    depth_++;
+    return true;
+  }
+
+  bool end_object() {
+    depth_--;
+    if (depth_ == 1) {
+      in_path_ = false;
+    }
+    return true;
+  }
+
+  bool start_array(std::size_t) {
+    if (depth_ == 2 && in_path_ && path_array_ >= 0) {
+      in_nodes_ = true;
+      if (path_array_ == DecodedEvent::kHopArrayCount) {
+        out_->has_path_nodes = true;
+      }
+    } else {
+      Scalar(Other());
+    }
+    depth_++;
+    return true;
+  }
+
+  bool end_array() {
+    depth_--;
+    if (depth_ == 2) {
+      in_nodes_ = false;
+    }
+    return true;
+  }
+
+  bool key(json::string_t &key) {
+    if (depth_ == 1) {
+      top_field_ = LookupEventField(key);
+    } else if (depth_ == 2 && in_path_) {
+      path_array_ = LookupPathArray(key);
+    }
+    return true;
+  }
+
+  bool parse_error(std::size_t, const std::string &, const nlohmann::detail::exception &) {
+    return false;
+  }
+
+  bool root_is_object() const { return root_is_object_; }
+
+ private:
+  static DecodedEvent::Value Number(int64_t value) {
+    DecodedEvent::Value out;
+    out.kind = DecodedEvent::Value::Kind::kNumber;
+    out.number = value;
+    out.real = static_cast<double>(value);
+    return out;
+  }
+
+  static DecodedEvent::Value Other() {
+    DecodedEvent::Value out;
+    out.kind = DecodedEvent::Value::Kind::kOther;
+    return out;
+  }
+
+  bool AtField() const {
+    return depth_ == 1 && top_field_ >= 0 && top_field_ < DecodedEvent::kFieldCount;
+  }
+
+  bool Wanted() const {
+    return AtField() || (depth_ == 3 && in_nodes_);
+  }
+
+  bool Scalar(const DecodedEvent::Value &value) {
+    if (AtField()) {
+      out_->fields[top_field_] = value;
+    } else if (depth_ == 3 && in_nodes_) {
+      out_->AppendPathValue(path_array_, value);
+    }
+    return true;
+  }
+
+  DecodedEvent *out_;
+  int depth_ = 0;
+  int top_field_ = -1;
+  bool root_is_object_ = false;
+  bool in_path_ = false;
+  int path_array_ = -1;
+  bool in_nodes_ = false;
+};
+
+bool DecodeEventDocumentSax(std::string_view document, DecodedEvent *event) {
+  event->Clear();
+  EventSaxHandler handler(event);
+  bool ok = json::sax_parse(document.begin(), document.end(), &handler);
+  return ok && handler.root_is_object();
+}
+
+// Payloads needing more tokens go to the SAX decoder.
+constexpr unsigned int kMaxEventTokens = 1024;
+
+bool IsJsonNumber(std::string_view text) {
+  size_t pos = text.size() > 0 && text[0] == '-' ? 1 : 0;
+  auto digits = [&]() {
+    size_t start = pos;
+    while (pos < text.size() && text[pos] >= '0' && text[pos] <= '9') {
+      pos++;
+    }
+    return pos - start;
+  };
+  size_t start = pos;
+  size_t integer = digits();
+  if (integer == 0 || (integer > 1 && text[start] == '0')) {
+    return false;
+  }
+  if (pos < text.size() && text[pos] == '.') {
+    pos++;
+    if (digits() == 0) {
+      return false;
+    }
+  }
+  if (pos < text.size() && (text[pos] == 'e' || text[pos] == 'E')) {
+    pos++;
+    if (pos < text.size() && (text[pos] == '+' || text[pos] == '-')) {
+      pos++;
+    }
+    if (digits() == 0) {
+      return false;
+    }
+  }
+  return pos == text.size();
+}
+
+// What nlohmann rejects in a string body and jsmn lets through: control
+// characters, bad \u escapes, unpaired surrogates and invalid UTF-8.
+bool IsJsonStringBody(std::string_view raw) {
+  for (size_t pos = 0; pos < raw.size();) {
+    unsigned char c = static_cast<unsigned char>(raw[pos]);
+    if (c < 0x20) {
+      return false;
+    }
+    if (c == '\\') {
+      if (pos + 1 < raw.size() && raw[pos + 1] != 'u') {
+        pos += 2;
+        continue;
+      }
+      uint32_t cp = 0;
+      if (!ParseHex4(raw, pos + 2, &cp) || (cp >= 0xDC00 && cp <= 0xDFFF)) {
+        return false;
+      }
+      pos += 6;
+      if (cp >= 0xD800 && cp <= 0xDBFF) {
+        uint32_t low = 0;
+        if (pos + 1 >= raw.size() || raw[pos] != '\\' || raw[pos + 1] != 'u' ||
+            !ParseHex4(raw, pos + 2, &low) || low < 0xDC00 || low > 0xDFFF) {
+          return false;
+        }
+        pos += 6;
+      }
+      continue;
+    }
+    if (c < 0x80) {
+      pos++;
+      continue;
+    }
+    size_t length = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : 2;
+    if (c < 0xC2 || c > 0xF4 || pos + length > raw.size()) {
+      return false;
+    }
+    unsigned char second = static_cast<unsigned char>(raw[pos + 1]);
+    unsigned char low = (c == 0xE0) ? 0xA0 : (c == 0xF0) ? 0x90 : 0x80;
+    unsigned char high = (c == 0xED) ? 0x9F : (c == 0xF4) ? 0x8F : 0xBF;
+    if (second < low || second > high) {
+      return false;
+    }
+    for (size_t i = 2; i < length; i++) {
+      if ((static_cast<unsigned char>(raw[pos + i]) & 0xC0) != 0x80) {
+        return false;
+      }
+    }
+    pos += length;
+  }
+  return true;
+}
+
+// This jsmn skips ':' and ',' wherever they appear and accepts any
+// primitive, so the text between and inside tokens is checked here. A
+// document that passes decodes exactly as the SAX decoder would decode it.
+class JsonTokenChecker {
+ public:
+  JsonTokenChecker(std::string_view document, const jsmntok_t *tokens, int count)
+      : document_(document), tokens_(tokens), count_(count) {}
+
+  bool Check() const {
+    if (count_ < 1 || !Gap(0, OuterStart(0), 0)) {
+      return false;
+    }
+    return Value(0) == count_ && Gap(OuterEnd(0), document_.size(), 0);
+  }
+
+ private:
+  size_t OuterStart(int index) const {
+    return static_cast<size_t>(tokens_[index].start) - (tokens_[index].type == JSMN_STRING);
+  }
+
+  size_t OuterEnd(int index) const {
+    return static_cast<size_t>(tokens_[index].end) + (tokens_[index].type == JSMN_STRING);
+  }
+
+  // Whitespace, plus exactly one `separator` unless it is 0.
+  bool Gap(size_t begin, size_t end, char separator) const {
+    bool seen = separator == 0;
+    for (size_t pos = begin; pos < end; pos++) {
+      char c = document_[pos];
+      if (c == separator && !seen) {
+        seen = true;
+      } else if (c != ' ' && c != '\t' && c != '\r' && c != '\n') {
+        return false;
+      }
+    }
+    return seen;
+  }
+
+  int Value(int index) const {
+    const jsmntok_t &tok = tokens_[index];
+    std::string_view text = document_.substr(static_cast<size_t>(tok.start),
+                                             static_cast<size_t>(tok.end - tok.start));
+    if (tok.type == JSMN_STRING) {
+      return IsJsonStringBody(text) ? index + 1 : -1;
+    }
+    if (tok.type == JSMN_PRIMITIVE) {
+      bool valid = text == "true" || text == "false" || text == "null" || IsJsonNumber(text);
+      return valid ? index + 1 : -1;
+    }
+    bool object = tok.type == JSMN_OBJECT;
+    if (object && tok.size % 2 != 0) {
+      return -1;
+    }
+    size_t pos = OuterStart(index) + 1;
+    int child = index + 1;
+    for (int n = 0; n < tok.size; n++) {
+      if (child >= count_ || tokens_[child].parent != index ||
+          (object && n % 2 == 0 && tokens_[child].type != JSMN_STRING)) {
+        return -1;
+      }
+      char separator = n == 0 ? 0 : (object && n % 2 == 1 ? ':' : ',');
+      if (!Gap(pos, OuterStart(child), separator)) {
+        return -1;
+      }
+      pos = OuterEnd(child);
+      child = Value(child);
+      if (child < 0) {
+        return -1;
+      }
+    }
+    return Gap(pos, OuterEnd(index) - 1, 0) ? child : -1;
+  }
+
+  std::string_view document_;
+  const jsmntok_t *tokens_;
+  int count_;
+};
+
+// Walks a jsmn token array. jsmn links every token to its parent but keeps
+// keys and values as siblings, so an object's children alternate key, value.
+class EventTokenWalker {
+ public:
+  EventTokenWalker(std::string_view document, const jsmntok_t *tokens, int count,
+                   DecodedEvent *out)
+      : document_(document), tokens_(tokens), count_(count), out_(out) {}
+
+  bool Walk() {
+    if (count_ < 1 || tokens_[0].type != JSMN_OBJECT) {
+      return false;
+    }
+    return ForEachMember(0, [this](std::string_view key, int value) {
+      int field = LookupEventField(key);
+      if (field == kEventPathKey) {
+        return tokens_[value].type != JSMN_OBJECT || WalkPath(value);
+      }
+      return field < 0 || ReadValue(value, &out_->fields[field]);
+    });
+  }
+
+ private:
+  std::string_view Text(int index) const {
+    const jsmntok_t &tok = tokens_[index];
+    return document_.substr(static_cast<size_t>(tok.start),
+                            static_cast<size_t>(tok.end - tok.start));
+  }
+
+  int NextSibling(int index) const {
+    int end = tokens_[index].end;
+    int next = index + 1;
+    while (next < count_ && tokens_[next].start < end) {
+      next++;
+    }
+    return next;
+  }
+
+  template <typename Fn>
+  bool ForEachMember(int object, Fn fn) const {
+    int index = object + 1;
+    for (int member = 0; member < tokens_[object].size / 2; member++) {
+      if (index + 1 >= count_ || tokens_[index].type != JSMN_STRING) {
+        return false;
+      }
+      if (!fn(Text(index), index + 1)) {
+        return false;
+      }
+      index = NextSibling(index + 1);
+    }
+    return tokens_[object].size % 2 == 0;
+  }
+
+  bool WalkPath(int object) {
+    return ForEachMember(object, [this](std::string_view key, int value) {
+      int array = LookupPathArray(key);
+      if (array < 0 || tokens_[value].type != JSMN_ARRAY) {
+        return true;
+      }
+      if (array == DecodedEvent::kHopArrayCount) {
+        out_->has_path_nodes = true;
+      }
+      int index = value + 1;
+      for (int i = 0; i < tokens_[value].size; i++) {
+        if (index >= count_) {
+          return false;
+        }
+        DecodedEvent::Value node;
+        if (!ReadValue(index, &node)) {
+          return false;
+        }
+        out_->AppendPathValue(array, node);
+        index = NextSibling(index);
+      }
+      return true;
+    });
+  }
+
+  bool ReadValue(int index, DecodedEvent::Value *out) {
+    const jsmntok_t &tok = tokens_[index];
+    std::string_view text = Text(index);
+    if (tok.type == JSMN_STRING) {
+      return out_->StoreRawString(text, out);
+    }
+    if (tok.type != JSMN_PRIMITIVE) {
+      out->kind = DecodedEvent::Value::Kind::kOther;
+      return true;
+    }
+    if (text == "null") {
+      *out = DecodedEvent::Value{};
+      return true;
+    }
+    if (text == "true" || text == "false") {
+      out->kind = DecodedEvent::Value::Kind::kOther;
+      return true;
+    }
+    char buffer[64];
+    if (text.empty() || text.size() >= sizeof(buffer)) {
+      return false;
+    }
+    std::memcpy(buffer, text.data(), text.size());
+    buffer[text.size()] = '\0';
+    char *end = nullptr;
+    double value = std::strtod(buffer, &end);
+    if (end != buffer + text.size() || !(text[0] == '-' || (text[0] >= '0' && text[0] <= '9'))) {
+      return false;
+    }
+    out->kind = DecodedEvent::Value::Kind::kNumber;
+    out->real = value;
+    if (text.find_first_of(".eE") == std::string_view::npos) {
+      // Past int64 the SAX decoder's conversion applies.
+      errno = 0;
+      out->number = std::strtoll(buffer, nullptr, 10);
+      if (errno == ERANGE) {
+        return false;
+      }
+    } else {
+      out->number = static_cast<int64_t>(value);
+    }
+    return true;
+  }
+
+  std::string_view document_;
+  const jsmntok_t *tokens_;
+  int count_;
+  DecodedEvent *out_;
+};
+
+bool DecodeEventDocumentJsmn(std::string_view document, DecodedEvent *event) {
+  thread_local std::array<jsmntok_t, kMaxEventTokens> tokens;
+  event->Clear();
+  jsmn_parser parser;
+  jsmn_init(&parser);
+  int count = jsmn_parse(&parser, document.data(), document.size(), tokens.data(),
+                         static_cast<unsigned int>(tokens.size()));
+  if (count <= 0 || !JsonTokenChecker(document, tokens.data(), count).Check()) {
+    return false;
+  }
+  EventTokenWalker walker(document, tokens.data(), count, event);
+  return walker.Walk();
+}
+
+bool DecodeEventDocument(std::string_view document, DecodedEvent *event) {
+  if (document.size() > 1024 * 1024 || !LooksLikeJsonObject(document)) {
+    return false;
+  }
+  if (DecodeEventDocumentJsmn(document, event)) {
+    return true;
+  }
+  return DecodeEventDocumentSax(document, event);
+}
+
+// One /sse or /stream frame, decoded in a single pass. Buffers are reused from
+// frame to frame; a kBatch frame carries its messages in `batch`.
+struct SseMessage {
+  enum class Type { kUnknown, kStatus, kPing, kPacket, kPropagation, kBatch, kReplayGap };
+  Type type = Type::kUnknown;
+  std::string status;
+  // Event id carried in /stream envelopes; /sse ids arrive as SSE fields.
+  std::string id;
+  // Messages lost before a kReplayGap, or -1 when the server cannot tell.
+  int64_t missed = -1;
+  std::string document;
+  DecodedEvent event;
+  // Entries past batch_size are left over from earlier, larger batches and
+  // kept for their buffers.
+  std::vector<SseMessage> batch;
+  size_t batch_size = 0;
+
+  SseMessage &NextBatchEntry() {
+    if (batch_size == batch.size()) {
+      batch.emplace_back();
+    }
+    return batch[batch_size];
+  }
+};
+
+size_t DecodeSseBatchEvents(std::string_view frame, size_t pos, SseMessage *message);
+
+// Sets *end past the envelope at frame[pos], or to npos when malformed.
+// Returns whether the envelope is a message this client handles.
+bool DecodeSseEnvelope(std::string_view frame, size_t pos, SseMessage *message, size_t *end) {
+  *end = std::string_view::npos;
+  message->type = SseMessage::Type::kUnknown;
+  message->batch_size = 0;
+  std::string_view type;
+  std::string_view data;
+  std::string_view status;
+  std::string_view missed;
+  pos++;
+  while (true) {
+    pos = SkipJsonWhitespace(frame, pos);
+    if (pos >= frame.size()) {
+      return false;
+    }
+    if (frame[pos] == '}') {
+      break;
+    }
+    if (frame[pos] == ',') {
+      pos++;
+      continue;
+    }
+    if (frame[pos] != '"') {
+      return false;
+    }
+    size_t key_end = SkipJsonString(frame, pos);
+    if (key_end == std::string_view::npos) {
+      return false;
+    }
+    std::string_view key = frame.substr(pos + 1, key_end - pos - 2);
+    pos = SkipJsonWhitespace(frame, key_end);
+    if (pos >= frame.size() || frame[pos] != ':') {
+      return false;
+    }
+    pos = SkipJsonWhitespace(frame, pos + 1);
+    size_t value_end = pos < frame.size() && frame[pos] == '[' && key == "events"
+                           ? DecodeSseBatchEvents(frame, pos, message)
+                           : SkipJsonValue(frame, pos);
+    if (value_end == std::string_view::npos) {
+      return false;
+    }
+    if (frame[pos] == '"') {
+      std::string_view raw = frame.substr(pos + 1, value_end - pos - 2);
+      if (key == "type") {
+        type = raw;
+      } else if (key == "data") {
+        data = raw;
+      } else if (key == "connectionStatus") {
+        status = raw;
+      }
+    } else if (key == "missed") {
+      missed = frame.substr(pos, value_end - pos);
+    }
+    pos = value_end;
+  }
+  *end = pos + 1;
+
+  if (type == "batch") {
+    message->type = SseMessage::Type::kBatch;
+    return true;
+  }
+  message->batch_size = 0;
+  if (type == "statusUpdate" || type == "connected") {
+    message->type = SseMessage::Type::kStatus;
+    return UnescapeJsonInto(status, &message->status);
+  }
+  if (type == "replayGap") {
+    message->type = SseMessage::Type::kReplayGap;
+    message->missed = !missed.empty() && missed[0] >= '0' && missed[0] <= '9'
+                          ? std::strtoll(std::string(missed).c_str(), nullptr, 10)
+                          : -1;
+    return true;
+  }
+  if (type == "ping") {
+    message->type = SseMessage::Type::kPing;
+    return true;
+  }
+  if (type != "packet" && type != "propagation") {
+    return false;
+  }
+  if (data.empty() || !UnescapeJsonInto(data, &message->document)) {
+    return false;
+  }
+  message->type = type == "packet" ? SseMessage::Type::kPacket : SseMessage::Type::kPropagation;
+  return DecodeEventDocument(message->document, &message->event);
+}
+
+// Decodes the "events" array into message->batch, skipping entries the client
+// does not handle. Returns the offset past the array, or npos.
+size_t DecodeSseBatchEvents(std::string_view frame, size_t pos, SseMessage *message) {
+  pos++;
+  while (true) {
+    pos = SkipJsonWhitespace(frame, pos);
+    if (pos >= frame.size()) {
+      return std::string_view::npos;
+    }
+    if (frame[pos] == ']') {
+      return pos + 1;
+    }
+    if (frame[pos] == ',') {
+      pos++;
+      continue;
+    }
+    size_t end = std::string_view::npos;
+    if (frame[pos] != '{') {
+      end = SkipJsonValue(frame, pos);
+    } else {
+      SseMessage &entry = message->NextBatchEntry();
+      if (DecodeSseEnvelope(frame, pos, &entry, &end) &&
+          entry.type != SseMessage::Type::kBatch) {
+        message->batch_size++;
+      }
+    }
+    if (end == std::string_view::npos) {
+      return end;
+    }
+    pos = end;
+  }
+}
+
+bool DecodeSseMessage(std::string_view frame, SseMessage *message) {
+  message->type = SseMessage::Type::kUnknown;
+  if (frame.size() > 1024 * 1024 || !LooksLikeJsonObject(frame)) {
+    return false;
+  }
+  size_t end = std::string_view::npos;
+  return DecodeSseEnvelope(frame, SkipJsonWhitespace(frame, 0), message, &end);
+}
+
+// /stream frame body: a MessagePack map whose "data" members go straight to an
+// EventSaxHandler, without materializing JSON text.
+class BinaryEnvelopeSaxHandler {
+ public:
+  explicit BinaryEnvelopeSaxHandler(SseMessage *out) : out_(out), event_(&out->event) {}
+
+  bool null() { return Forward([](auto &h) { return h.null(); }); }
+  bool boolean(bool value) { return Forward([&](auto &h) { return h.boolean(value); }); }
+  bool number_integer(json::number_integer_t value) {
+    if (AtTopLevel(Key::kMissed)) {
+      out_->missed = value;
+    }
+    return Forward([&](auto &h) { return h.number_integer(value); });
+  }
+  bool number_unsigned(json::number_unsigned_t value) {
+    if (AtTopLevel(Key::kMissed)) {
+      out_->missed = static_cast<int64_t>(value);
+    }
+    return Forward([&](auto &h) { return h.number_unsigned(value); });
+  }
+  bool number_float(json::number_float_t value, const json::string_t &text) {
+    return Forward([&](auto &h) { return h.number_float(value, text); });
+  }
+  bool string(json::string_t &value) {
+    if (entry_depth_ > 0) {
+      return entry_->string(value);
+    }
+    if (forwarding_) {
+      return event_.string(value);
+    }
+    if (depth_ == 1 && key_ == Key::kType) {
+      type_ = value;
+    } else if (depth_ == 1 && key_ == Key::kStatus) {
+      out_->status = value;
+    } else if (depth_ == 1 && key_ == Key::kId) {
+      out_->id = value;
+    }
+    return true;
+  }
+  bool binary(json::binary_t &value) { return Forward([&](auto &h) { return h.binary(value); }); }
+
+  bool start_object(std::size_t size) {
+    if (entry_depth_ > 0) {
+      entry_depth_++;
+      return entry_->start_object(size);
+    }
+    if (in_events_ && depth_ == 2) {
+      SseMessage &entry = out_->NextBatchEntry();
+      ResetBinaryMessage(&entry);
+      if (!entry_) {
+        entry_ = std::make_unique<BinaryEnvelopeSaxHandler>(&entry);
+      } else {
+        *entry_ = BinaryEnvelopeSaxHandler(&entry);
+      }
+      entry_depth_ = 1;
+      return entry_->start_object(size);
+    }
+    if (forwarding_) {
+      data_depth_++;
+      return event_.start_object(size);
+    }
+    if (depth_ == 0) {
+      root_is_object_ = true;
+    } else if (depth_ == 1 && key_ == Key::kData) {
+      forwarding_ = true;
+      has_data_ = true;
+      data_depth_ = 1;
+      return event_.start_object(size);
+    }
+    depth_++;
+    return true;
+  }
+  bool end_object() {
+    if (entry_depth_ > 0) {
+      bool ok = entry_->end_object();
+      if (--entry_depth_ == 0) {
+        SseMessage &entry = out_->batch[out_->batch_size];
+        if (ok && FinishBinaryMessage(*entry_, &entry) && entry.type != SseMessage::Type::kBatch) {
+          out_->batch_size++;
+        }
+      }
+      return ok;
+    }
+    if (forwarding_) {
+      forwarding_ = --data_depth_ > 0;
+      return event_.end_object();
+    }
+    depth_--;
+    return true;
+  }
+  bool start_array(std::size_t size) {
+    if (entry_depth_ > 0) {
+      entry_depth_++;
+      return entry_->start_array(size);
+    }
+    if (forwarding_) {
+      data_depth_++;
+      return event_.start_array(size);
+    }
+    if (depth_ == 1 && key_ == Key::kEvents) {
+      in_events_ = true;
+    }
+    depth_++;
+    return true;
+  }
+  bool end_array() {
+    if (entry_depth_ > 0) {
+      entry_depth_--;
+      return entry_->end_array();
+    }
+    if (forwarding_) {
+      data_depth_--;
+      return event_.end_array();
+    }
+    depth_--;
+    if (depth_ == 1) {
+      in_events_ = false;
+    }
+    return true;
+  }
+  bool key(json::string_t &key) {
+    if (entry_depth_ > 0) {
+      return entry_->key(key);
+    }
+    if (forwarding_) {
+      return event_.key(key);
+    }
+    if (depth_ == 1) {
+      key_ = key == "type" ? Key::kType
+           : key == "data" ? Key::kData
+           : key == "connectionStatus" ? Key::kStatus
+           : key == "events" ? Key::kEvents
+           : key == "id" ? Key::kId
+           : key == "missed" ? Key::kMissed
+           : Key::kOther;
+    }
+    return true;
+  }
+  bool parse_error(std::size_t, const std::string &, const nlohmann::detail::exception &) {
+    return false;
+  }
+
+  bool root_is_object() const { return root_is_object_; }
+  bool has_data() const { return has_data_; }
+  const std::string &type() const { return type_; }
+
+  static void ResetBinaryMessage(SseMessage *message) {
+    message->type = SseMessage::Type::kUnknown;
+    message->status.clear();
+    message->document.clear();
+    message->event.Clear();
+    message->batch_size = 0;
+    message->id.clear();
+    message->missed = -1;
+  }
+
+  static bool FinishBinaryMessage(const BinaryEnvelopeSaxHandler &handler, SseMessage *message);
+
+ private:
+  enum class Key { kOther, kType, kData, kStatus, kEvents, kId, kMissed };
+
+  bool AtTopLevel(Key key) const {
+    return entry_depth_ == 0 && !forwarding_ && depth_ == 1 && key_ == key;
+  }
+
+  // Scalars inside a batch entry go to the entry's handler, scalars inside
+  // "data" to the event decoder.
+  template <typename Fn>
+  bool Forward(Fn fn) {
+    return entry_depth_ > 0 ? fn(*entry_) : (forwarding_ ? fn(event_) : true);
+  }
+
+  SseMessage *out_;
+  EventSaxHandler event_;
+  std::string type_;
+  Key key_ = Key::kOther;
+  int depth_ = 0;
+  int data_depth_ = 0;
+  bool forwarding_ = false;
+  bool root_is_object_ = false;
+  bool has_data_ = false;
+  bool in_events_ = false;
+  int entry_depth_ = 0;
+  std::unique_ptr<BinaryEnvelopeSaxHandler> entry_;
 };
 
-json ParseJson(const std::string &input) {
-  std::lock_guard<std::mutex> lock(g_json_mutex);
-  return json::parse(input, nullptr, false);
+bool BinaryEnvelopeSaxHandler::FinishBinaryMessage(const BinaryEnvelopeSaxHandler &handler,
+                                                   SseMessage *message) {
+  if (!handler.root_is_object()) {
+    return false;
+  }
+  const std::string &type = handler.type();
+  if (type == "batch") {
+    message->type = SseMessage::Type::kBatch;
+    return true;
+  }
+  if (type == "statusUpdate" || type == "connected") {
+    message->type = SseMessage::Type::kStatus;
+    return true;
+  }
+  if (type == "replayGap") {
+    message->type = SseMessage::Type::kReplayGap;
+    return true;
+  }
+  if (type == "ping") {
+    message->type = SseMessage::Type::kPing;
+    return true;
+  }
+  if ((type != "packet" && type != "propagation") || !handler.has_data()) {
+    return false;
+  }
+  message->type = type == "packet" ? SseMessage::Type::kPacket : SseMessage::Type::kPropagation;
+  return true;
 }
 
-std::string JsonGetString(const json &obj, const char *key) {
-  auto it = obj.find(key);
-  if (it != obj.end() && it->is_string()) {
-    return it->get<std::string>();
+bool DecodeBinaryMessage(std::string_view frame, SseMessage *message) {
+  BinaryEnvelopeSaxHandler::ResetBinaryMessage(message);
+  BinaryEnvelopeSaxHandler handler(message);
+  if (!json::sax_parse(frame.begin(), frame.end(), &handler, json::input_format_t::msgpack)) {
+    return false;
   }
-  return {};
+  return BinaryEnvelopeSaxHandler::FinishBinaryMessage(handler, message);
+}
+
+std::string FormatTimeNow() {
+  std::time_t now = std::time(nullptr);
+  std::tm tm = *std::localtime(&now);
+  char buf[16];
+  std::strftime(buf, sizeof(buf), "%H:%M:%S", &tm);
+  return buf;
 }
 
-bool JsonGetBool(const json &obj, const char *key, bool fallback) {
-  auto it = obj.find(key);
-  if (it != obj.end() && it->is_boolean()) {
-    return it->get<bool>();
+void UpdateNodeIndex(NodeStore &store) {
+  store.node_hash_index.clear();
+  std::vector<PrefixIndex::Entry> key_entries;
+  std::vector<PrefixIndex::Entry> hash_entries;
+  for (size_t i = 0; i < store.nodes.size(); i++) {
+    const Node &node = store.nodes[i];
+    uint32_t index = static_cast<uint32_t>(i);
+    if (node.node_hash != 0) {
+      store.node_hash_index[node.node_hash] = i;
+      char hash_hex[16];
+      int length = std::snprintf(hash_hex, sizeof(hash_hex), "%X",
+                                 static_cast<unsigned>(node.node_hash));
+      PackedHex hash_key;
+      ParsePackedHex(std::string_view(hash_hex, static_cast<size_t>(length)), &hash_key);
+      hash_entries.push_back(PrefixIndex::MakeEntry(hash_key, index));
+    }
+    if (!node.public_key.empty()) {
+      key_entries.push_back(PrefixIndex::MakeEntry(node.public_key, index));
+    }
   }
-  return fallback;
+  hash_entries.insert(hash_entries.end(), key_entries.begin(), key_entries.end());
+  store.public_key_index.Build(std::move(key_entries));
+  store.token_index.Build(std::move(hash_entries));
 }
 
-bool LooksLikeJsonObject(const std::string &input) {
-  for (char c : input) {
-    if (c == ' ' || c == '\n' || c == '\r' || c == '\t') {
-      continue;
+struct AdvertScalar {
+  enum class Kind { kNumber, kBool, kString };
+  Kind kind = Kind::kNumber;
+  double number = 0.0;
+  bool boolean = false;
+  const std::string *text = nullptr;
+};
+
+struct AdvertBuilder {
+  StringArena *arena = nullptr;
+  Node node;
+  bool has_lat = false;
+  bool has_lon = false;
+  bool has_lng = false;
+  double lat = 0.0;
+  double lon = 0.0;
+  double lng = 0.0;
+  // Set on the removal markers of a ?since= delta response.
+  bool removed = false;
+
+  void Finish(Node *out) {
+    if (has_lat) {
+      node.lat = lat;
     }
-    return c == '{';
+    node.lon = has_lon ? lon : (has_lng ? lng : 0.0);
+    node.has_position = has_lat && (has_lon || has_lng) && !(node.lat == 0.0 && node.lon == 0.0) &&
+                        std::abs(node.lat) <= 90.0 && std::abs(node.lon) <= 180.0;
+    *out = node;
   }
-  return false;
+};
+
+using AdvertSetter = void (*)(AdvertBuilder &, const AdvertScalar &);
+
+struct AdvertField {
+  std::string_view key;
+  AdvertSetter set;
+};
+
+// One setter per advert key; scalars of the wrong kind are ignored.
+constexpr AdvertField kAdvertFields[] = {
+  {"id", [](AdvertBuilder &b, const AdvertScalar &v) {
+     if (v.kind == AdvertScalar::Kind::kNumber) b.node.id = static_cast<int>(v.number);
+   }},
+  {"node_hash", [](AdvertBuilder &b, const AdvertScalar &v) {
+     if (v.kind == AdvertScalar::Kind::kNumber) b.node.node_hash = static_cast<int>(v.number);
+   }},
+  {"name", [](AdvertBuilder &b, const AdvertScalar &v) {
+     if (v.kind == AdvertScalar::Kind::kString) b.node.name = b.arena->Intern(*v.text);
+   }},
+  {"public_key_hex", [](AdvertBuilder &b, const AdvertScalar &v) {
+     if (v.kind == AdvertScalar::Kind::kString) ParsePackedHex(*v.text, &b.node.public_key);
+   }},
+  {"is_room_server", [](AdvertBuilder &b, const AdvertScalar &v) {
+     if (v.kind == AdvertScalar::Kind::kBool) b.node.is_room_server = v.boolean;
+   }},
+  {"is_repeater", [](AdvertBuilder &b, const AdvertScalar &v) {
+     if (v.kind == AdvertScalar::Kind::kBool) b.node.is_repeater = v.boolean;
+   }},
+  {"is_chat_node", [](AdvertBuilder &b, const AdvertScalar &v) {
+     if (v.kind == AdvertScalar::Kind::kBool) b.node.is_chat_node = v.boolean;
+   }},
+  {"is_sensor", [](AdvertBuilder &b, const AdvertScalar &v) {
+     if (v.kind == AdvertScalar::Kind::kBool) b.node.is_sensor = v.boolean;
+   }},
+  {"lat", [](AdvertBuilder &b, const AdvertScalar &v) {
+     if (v.kind == AdvertScalar::Kind::kNumber) { b.lat = v.number; b.has_lat = true; }
+   }},
+  {"lon", [](AdvertBuilder &b, const AdvertScalar &v) {
+     if (v.kind == AdvertScalar::Kind::kNumber) { b.lon = v.number; b.has_lon = true; }
+   }},
+  {"lng", [](AdvertBuilder &b, const AdvertScalar &v) {
+     if (v.kind == AdvertScalar::Kind::kNumber) { b.lng = v.number; b.has_lng = true; }
+   }},
+  {"removed", [](AdvertBuilder &b, const AdvertScalar &v) {
+     if (v.kind == AdvertScalar::Kind::kBool) b.removed = v.boolean;
+   }},
+};
+
+template <size_t N>
+constexpr std::array<std::string_view, N> KeysOf(const AdvertField (&fields)[N]) {
+  std::array<std::string_view, N> keys{};
+  for (size_t i = 0; i < N; i++) {
+    keys[i] = fields[i].key;
+  }
+  return keys;
 }
 
-std::string ExtractJsonStringField(const std::string &input, const char *key) {
-  std::string pattern = "\"";
-  pattern += key;
-  pattern += "\"";
-  size_t pos = input.find(pattern);
-  if (pos == std::string::npos) {
-    return {};
+constexpr auto kAdvertKeys = KeysOf(kAdvertFields);
+constexpr PerfectKeyTable<kAdvertKeys.size(), 16> kAdvertKeyTable(kAdvertKeys);
+static_assert(kAdvertKeyTable.Find("public_key_hex") == 3, "advert key table");
+static_assert(kAdvertKeyTable.Find("longitude") == -1, "advert key table");
+
+class AdvertSaxHandler {
+ public:
+  explicit AdvertSaxHandler(StringArena *arena) { builder_.arena = arena; }
+
+  bool null() { return true; }
+  bool boolean(bool value) {
+    AdvertScalar scalar;
+    scalar.kind = AdvertScalar::Kind::kBool;
+    scalar.boolean = value;
+    return Set(scalar);
   }
-  pos = input.find(':', pos + pattern.size());
-  if (pos == std::string::npos) {
-    return {};
+  bool number_integer(json::number_integer_t value) { return Number(static_cast<double>(value)); }
+  bool number_unsigned(json::number_unsigned_t value) { return Number(static_cast<double>(value)); }
+  bool number_float(json::number_float_t value, const json::string_t &) { return Number(value); }
+  bool string(json::string_t &value) {
+    AdvertScalar scalar;
+    scalar.kind = AdvertScalar::Kind::kString;
+    scalar.text = &value;
+    return Set(scalar);
   }
-  pos++;
-  while (pos < input.size() && (input[pos] == ' ' || input[pos] == '\t' || input[pos] == '\r' || input[pos] == '\n')) {
-    pos++;
+  bool binary(json::binary_t &) { return true; }
+  bool start_object(std::size_t) {
+    if (depth_ == 0) {
+      is_object_ = true;
+    }
+    depth_++;
+    return true;
   }
-  if (pos >= input.size() || input[pos] != '"') {
-    return {};
+  bool end_object() {
+    depth_--;
+    return true;
   }
-  pos++;
-  std::string out;
-  out.reserve(128);
-  bool escape = false;
-  for (; pos < input.size(); pos++) {
-    char c = input[pos];
-    if (escape) {
-      out.push_back(c);
-      escape = false;
-      continue;
+  bool start_array(std::size_t) {
+    depth_++;
+    return true;
+  }
+  bool end_array() {
+    depth_--;
+    return true;
+  }
+  bool key(json::string_t &key) {
+    if (depth_ == 1) {
+      field_ = kAdvertKeyTable.Find(key);
     }
-    if (c == '\\') {
-      escape = true;
-      continue;
+    return true;
+  }
+  bool parse_error(std::size_t, const std::string &, const nlohmann::detail::exception &) {
+    return false;
+  }
+
+  bool Finish(Node *out) {
+    if (!is_object_) {
+      return false;
     }
-    if (c == '"') {
-      break;
+    builder_.Finish(out);
+    return true;
+  }
+
+  bool removed() const { return builder_.removed; }
+
+ private:
+  bool Number(double value) {
+    AdvertScalar scalar;
+    scalar.number = value;
+    return Set(scalar);
+  }
+
+  bool Set(const AdvertScalar &scalar) {
+    if (depth_ == 1 && field_ >= 0) {
+      kAdvertFields[field_].set(builder_, scalar);
     }
-    out.push_back(c);
+    return true;
+  }
+
+  AdvertBuilder builder_;
+  int depth_ = 0;
+  int field_ = -1;
+  bool is_object_ = false;
+};
+
+// `removed`, when given, reports whether the element is a delta removal
+// marker ({"id": ..., "removed": true}) rather than an advert.
+bool ParseAdvertElement(std::string_view element, StringArena &arena, Node *out,
+                        bool *removed = nullptr) {
+  AdvertSaxHandler handler(&arena);
+  if (!json::sax_parse(element.begin(), element.end(), &handler)) {
+    return false;
+  }
+  if (removed) {
+    *removed = handler.removed();
   }
-  return out;
+  return handler.Finish(out);
 }
 
-std::string UnescapeJsonString(const std::string &input) {
-  std::string out;
-  out.reserve(input.size());
-  bool escape = false;
-  for (size_t i = 0; i < input.size(); i++) {
-    char c = input[i];
-    if (escape) {
-      switch (c) {
-        case 'n': out.push_back('\n'); break;
-        case 'r': out.push_back('\r'); break;
-        case 't': out.push_back('\t'); break;
-        case '\\': out.push_back('\\'); break;
-        case '"': out.push_back('"'); break;
-        default: out.push_back(c); break;
+// Splits a JSON array into elements as bytes arrive; only the element in
+// progress is buffered.
+class JsonArrayStreamSplitter {
+ public:
+  enum class State { kBeforeArray, kInArray, kDone, kError };
+
+  template <typename Handler>
+  void Feed(const char *bytes, size_t size, Handler &&on_element) {
+    size_t run_start = 0;
+    for (size_t i = 0; i < size; i++) {
+      char c = bytes[i];
+      if (state_ != State::kInArray) {
+        if (state_ == State::kBeforeArray) {
+          if (c == '[') {
+            state_ = State::kInArray;
+          } else if (!IsSpace(c)) {
+            state_ = State::kError;
+          }
+        }
+        continue;
+      }
+      if (!in_element_) {
+        if (IsSpace(c) || c == ',') {
+          continue;
+        }
+        if (c == ']') {
+          state_ = State::kDone;
+          continue;
+        }
+        in_element_ = true;
+        depth_ = 0;
+        run_start = i;
+      }
+      bool complete = false;
+      if (in_string_) {
+        if (escape_) {
+          escape_ = false;
+        } else if (c == '\\') {
+          escape_ = true;
+        } else if (c == '"') {
+          in_string_ = false;
+          complete = depth_ == 0;
+        }
+      } else if (c == '"') {
+        in_string_ = true;
+      } else if (c == '{' || c == '[') {
+        depth_++;
+      } else if (c == '}' || c == ']') {
+        if (depth_ == 0) {
+          // A bare primitive ended by the array's closing bracket.
+          EmitPrimitive(bytes + run_start, i - run_start, on_element);
+          state_ = State::kDone;
+          continue;
+        }
+        complete = --depth_ == 0;
+      } else if (depth_ == 0 && (c == ',' || IsSpace(c))) {
+        EmitPrimitive(bytes + run_start, i - run_start, on_element);
+        continue;
+      }
+      if (complete) {
+        element_.append(bytes + run_start, i + 1 - run_start);
+        on_element(std::string_view(element_));
+        element_.clear();
+        in_element_ = false;
       }
-      escape = false;
-      continue;
     }
-    if (c == '\\') {
-      escape = true;
-      continue;
+    if (in_element_) {
+      element_.append(bytes + run_start, size - run_start);
     }
-    out.push_back(c);
   }
-  return out;
-}
 
-std::string FormatTimeNow() {
-  std::time_t now = std::time(nullptr);
-  std::tm tm = *std::localtime(&now);
-  char buf[16];
-  std::strftime(buf, sizeof(buf), "%H:%M:%S", &tm);
-  return buf;
+  State state() const { return state_; }
+
+ private:
+  static bool IsSpace(char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; }
+
+  template <typename Handler>
+  void EmitPrimitive(const char *bytes, size_t length, Handler &on_element) {
+    element_.append(bytes, length);
+    on_element(std::string_view(element_));
+    element_.clear();
+    in_element_ = false;
+  }
+
+  State state_ = State::kBeforeArray;
+  bool in_element_ = false;
+  bool in_string_ = false;
+  bool escape_ = false;
+  int depth_ = 0;
+  std::string element_;
+};
+
+struct AdvertStreamState {
+  JsonArrayStreamSplitter splitter;
+  StringArena *arena = nullptr;
+  std::vector<Node> nodes;
+  std::vector<int> removed_ids;
+  size_t skipped = 0;
+  size_t bytes_fed = 0;
+
+  void Feed(const char *bytes, size_t size) {
+    bytes_fed += size;
+    splitter.Feed(bytes, size, [this](std::string_view element) {
+      Node node;
+      bool removed = false;
+      if (!ParseAdvertElement(element, *arena, &node, &removed)) {
+        skipped++;
+      } else if (removed) {
+        removed_ids.push_back(node.id);
+      } else {
+        nodes.push_back(node);
+      }
+    });
+  }
+};
+
+std::vector<Node> ParseNodesJson(std::string_view json, StringArena &arena) {
+  AdvertStreamState stream;
+  stream.arena = &arena;
+  stream.Feed(json.data(), json.size());
+  if (stream.splitter.state() != JsonArrayStreamSplitter::State::kDone) {
+    std::cerr << "ParseNodesJson: unexpected JSON root\n";
+    return {};
+  }
+  return std::move(stream.nodes);
 }
 
-void UpdateNodeIndex(AppState &state) {
-  state.node_hash_index.clear();
-  for (size_t i = 0; i < state.nodes.size(); i++) {
-    if (state.nodes[i].node_hash != 0) {
-      state.node_hash_index[state.nodes[i].node_hash] = i;
+// Finds top-level array elements by a structural scan, without validating them.
+bool FindArrayElements(std::string_view json, std::vector<std::string_view> *elements) {
+  elements->clear();
+  size_t pos = SkipJsonWhitespace(json, 0);
+  if (pos >= json.size() || json[pos] != '[') {
+    return false;
+  }
+  pos++;
+  while (true) {
+    pos = SkipJsonWhitespace(json, pos);
+    if (pos >= json.size()) {
+      return false;
+    }
+    if (json[pos] == ']') {
+      return true;
     }
+    if (json[pos] == ',') {
+      pos++;
+      continue;
+    }
+    size_t end = SkipJsonValue(json, pos);
+    if (end == std::string_view::npos) {
+      return false;
+    }
+    elements->push_back(json.substr(pos, end - pos));
+    pos = end;
   }
 }
 
-std::vector<Node> ParseNodesJson(const std::string &json) {
-  std::vector<Node> nodes;
-  try {
-    auto root = ParseJson(json);
-    if (root.is_discarded() || !root.is_array()) {
-      std::cerr << "ParseNodesJson: unexpected JSON root\n";
-      return nodes;
+class WorkerPool {
+ public:
+  explicit WorkerPool(size_t threads) {
+    for (size_t i = 0; i < threads; i++) {
+      workers_.emplace_back([this]() { WorkerLoop(); });
     }
+  }
 
-    for (const auto &entry : root) {
-      if (!entry.is_object()) {
-        continue;
-      }
-      Node node;
-      auto id_it = entry.find("id");
-      if (id_it != entry.end() && id_it->is_number()) {
-        node.id = id_it->get<int>();
-      }
-      auto hash_it = entry.find("node_hash");
-      if (hash_it != entry.end() && hash_it->is_number()) {
-        node.node_hash = hash_it->get<int>();
-      }
-      node.name = JsonGetString(entry, "name");
-      node.public_key_hex = JsonGetString(entry, "public_key_hex");
-      node.is_room_server = JsonGetBool(entry, "is_room_server", false);
-      node.is_repeater = JsonGetBool(entry, "is_repeater", false);
-      node.is_chat_node = JsonGetBool(entry, "is_chat_node", false);
-      node.is_sensor = JsonGetBool(entry, "is_sensor", false);
+  ~WorkerPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    wake_.notify_all();
+    for (std::thread &worker : workers_) {
+      worker.join();
+    }
+  }
 
-      auto lat_it = entry.find("lat");
-      auto lon_it = entry.find("lon");
-      auto lng_it = entry.find("lng");
-      bool has_lat = lat_it != entry.end() && lat_it->is_number();
-      bool has_lon = lon_it != entry.end() && lon_it->is_number();
-      bool has_lng = lng_it != entry.end() && lng_it->is_number();
+  void Run(size_t count, const std::function<void(size_t)> &task) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    task_ = &task;
+    next_ = 0;
+    count_ = count;
+    pending_ = count;
+    wake_.notify_all();
+    done_.wait(lock, [this]() { return pending_ == 0; });
+    task_ = nullptr;
+  }
+
+  size_t size() const { return workers_.size(); }
 
-      if (has_lat) {
-        node.lat = lat_it->get<double>();
+ private:
+  void WorkerLoop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      wake_.wait(lock, [this]() { return stopping_ || (task_ && next_ < count_); });
+      if (stopping_) {
+        return;
       }
-      if (has_lon) {
-        node.lon = lon_it->get<double>();
-      } else if (has_lng) {
-        node.lon = lng_it->get<double>();
-        has_lon = true;
+      size_t index = next_++;
+      const std::function<void(size_t)> *task = task_;
+      lock.unlock();
+      (*task)(index);
+      lock.lock();
+      if (--pending_ == 0) {
+        done_.notify_all();
       }
+    }
+  }
+
+  std::vector<std::thread> workers_;
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::condition_variable done_;
+  const std::function<void(size_t)> *task_ = nullptr;
+  size_t next_ = 0;
+  size_t count_ = 0;
+  size_t pending_ = 0;
+  bool stopping_ = false;
+};
 
-      node.has_position = has_lat && has_lon && !(node.lat == 0.0 && node.lon == 0.0) &&
-                          std::abs(node.lat) <= 90.0 && std::abs(node.lon) <= 180.0;
+// Chunks parse into scratch arenas; the merge interns into `arena` on the
+// calling thread, which keeps it single-threaded.
+std::vector<Node> ParseNodesJsonParallel(std::string_view json, StringArena &arena,
+                                         WorkerPool &pool) {
+  std::vector<std::string_view> elements;
+  if (!FindArrayElements(json, &elements)) {
+    std::cerr << "ParseNodesJson: unexpected JSON root\n";
+    return {};
+  }
+  size_t chunks = std::max<size_t>(1, std::min(pool.size(), elements.size()));
+  std::vector<std::vector<Node>> chunk_nodes(chunks);
+  std::vector<StringArena> chunk_arenas(chunks);
+  pool.Run(chunks, [&](size_t chunk) {
+    size_t begin = elements.size() * chunk / chunks;
+    size_t end = elements.size() * (chunk + 1) / chunks;
+    chunk_arenas[chunk].BeginGeneration();
+    chunk_nodes[chunk].reserve(end - begin);
+    for (size_t i = begin; i < end; i++) {
+      Node node;
+      if (ParseAdvertElement(elements[i], chunk_arenas[chunk], &node)) {
+        chunk_nodes[chunk].push_back(node);
+      }
+    }
+  });
 
+  std::vector<Node> nodes;
+  nodes.reserve(elements.size());
+  for (const std::vector<Node> &chunk : chunk_nodes) {
+    for (Node node : chunk) {
+      node.name = arena.Intern(node.name);
       nodes.push_back(node);
     }
-  } catch (const std::exception &e) {
-    std::cerr << "ParseNodesJson error: " << e.what() << "\n";
   }
-
   return nodes;
 }
 
@@ -483,49 +3295,38 @@ SDL_Color ColorForNode(const Node &node) {
   return SDL_Color{0, 255, 234, 255};
 }
 
-const Node *FindNodeByPublicKeyPrefix(const std::vector<Node> &nodes, const std::string &prefix) {
-  if (prefix.empty()) {
+// First node in list order whose public key starts with the hex prefix.
+const Node *FindNodeByPublicKeyPrefix(const NodeStore &store, std::string_view prefix) {
+  PackedHex key;
+  if (!ParsePackedHex(prefix, &key)) {
     return nullptr;
   }
-  std::string needle = prefix;
-  std::transform(needle.begin(), needle.end(), needle.begin(), ::toupper);
-  for (const auto &node : nodes) {
-    if (node.public_key_hex.empty()) {
-      continue;
-    }
-    std::string hex = node.public_key_hex;
-    std::transform(hex.begin(), hex.end(), hex.begin(), ::toupper);
-    if (hex.rfind(needle, 0) == 0) {
-      return &node;
-    }
+  long index = store.public_key_index.FindFirst(key);
+  return index < 0 ? nullptr : &store.nodes[static_cast<size_t>(index)];
+}
+
+// First node whose public key or node_hash hex starts with token.
+const Node *FindNodeByPropagationToken(const NodeStore &store, std::string_view token) {
+  PackedHex key;
+  if (!ParsePackedHex(token, &key)) {
+    return nullptr;
   }
-  return nullptr;
+  long index = store.token_index.FindFirst(key);
+  return index < 0 ? nullptr : &store.nodes[static_cast<size_t>(index)];
 }
 
-const Node *FindNodeByPropagationToken(const std::vector<Node> &nodes, const std::string &token) {
-  if (token.empty()) {
+const Node *ResolvePropagationToken(const NodeStore &store, TokenResolutionCache &cache,
+                                    std::string_view token) {
+  PackedHex key;
+  if (!ParsePackedHex(token, &key)) {
     return nullptr;
   }
-  std::string needle = token;
-  std::transform(needle.begin(), needle.end(), needle.begin(), ::toupper);
-  for (const auto &node : nodes) {
-    if (!node.public_key_hex.empty()) {
-      std::string hex = node.public_key_hex;
-      std::transform(hex.begin(), hex.end(), hex.begin(), ::toupper);
-      if (hex.rfind(needle, 0) == 0) {
-        return &node;
-      }
-    }
-    if (node.node_hash != 0) {
-      std::ostringstream oss;
-      oss << std::uppercase << std::hex << node.node_hash;
-      std::string hash_hex = oss.str();
-      if (hash_hex.rfind(needle, 0) == 0) {
-        return &node;
-      }
-    }
+  long index = cache.Lookup(key, store.generation);
+  if (index == TokenResolutionCache::kNotCached) {
+    index = store.token_index.FindFirst(key);
+    cache.Insert(key, store.generation, index);
   }
-  return nullptr;
+  return index < 0 ? nullptr : &store.nodes[static_cast<size_t>(index)];
 }
 
 void DrawFilledCircle(SDL_Renderer *renderer, int cx, int cy, int radius, SDL_Color color) {
@@ -570,35 +3371,294 @@ void DrawText(SDL_Renderer *renderer, TTF_Font *font, const std::string &text,
   if (!texture) {
     return;
   }
-  SDL_RenderCopy(renderer, texture, nullptr, &dst);
-  SDL_DestroyTexture(texture);
-}
+  SDL_RenderCopy(renderer, texture, nullptr, &dst);
+  SDL_DestroyTexture(texture);
+}
+
+// Incremental text/event-stream parser following the WHATWG EventSource
+// rules. Consumed bytes are dropped once per Feed, not once per line.
+class SseFramer {
+ public:
+  struct Event {
+    std::string_view type;
+    std::string_view data;
+    std::string_view id;
+  };
+
+  template <typename Handler>
+  void Feed(const char *bytes, size_t size, Handler &&on_event) {
+    if (read_ == buffer_.size()) {
+      buffer_.clear();
+      read_ = 0;
+    } else if (read_ > 0) {
+      buffer_.erase(0, read_);
+      read_ = 0;
+    }
+    buffer_.append(bytes, size);
+
+    while (read_ < buffer_.size()) {
+      const char *begin = buffer_.data() + read_;
+      size_t avail = buffer_.size() - read_;
+      if (skip_lf_) {
+        skip_lf_ = false;
+        if (*begin == '\n') {
+          read_++;
+          continue;
+        }
+      }
+      if (!bom_checked_) {
+        if (avail < 3 && std::memcmp(begin, "\xEF\xBB\xBF", avail) == 0) {
+          return;
+        }
+        bom_checked_ = true;
+        if (std::memcmp(begin, "\xEF\xBB\xBF", 3) == 0) {
+          read_ += 3;
+          continue;
+        }
+      }
+      const char *lf = static_cast<const char *>(std::memchr(begin, '\n', avail));
+      size_t scan = lf ? static_cast<size_t>(lf - begin) : avail;
+      const char *cr = static_cast<const char *>(std::memchr(begin, '\r', scan));
+      const char *end = cr ? cr : lf;
+      if (!end) {
+        break;
+      }
+      skip_lf_ = end == cr;
+      size_t length = static_cast<size_t>(end - begin);
+      read_ += length + 1;
+      ProcessLine(std::string_view(begin, length), on_event);
+    }
+  }
+
+  const std::string &last_event_id() const { return last_event_id_; }
+  long retry_ms() const { return retry_ms_; }
+
+ private:
+  template <typename Handler>
+  void ProcessLine(std::string_view line, Handler &on_event) {
+    if (line.empty()) {
+      if (!data_.empty()) {
+        data_.pop_back();
+        Event event;
+        event.type = type_.empty() ? std::string_view("message") : std::string_view(type_);
+        event.data = data_;
+        event.id = last_event_id_;
+        on_event(event);
+      }
+      data_.clear();
+      type_.clear();
+      return;
+    }
+    if (line.front() == ':') {
+      return;
+    }
+    std::string_view field = line;
+    std::string_view value;
+    size_t colon = line.find(':');
+    if (colon != std::string_view::npos) {
+      field = line.substr(0, colon);
+      value = line.substr(colon + 1);
+      if (!value.empty() && value.front() == ' ') {
+        value.remove_prefix(1);
+      }
+    }
+    if (field == "data") {
+      data_.append(value.data(), value.size());
+      data_.push_back('\n');
+    } else if (field == "event") {
+      type_.assign(value.data(), value.size());
+    } else if (field == "id") {
+      if (value.find('\0') == std::string_view::npos) {
+        last_event_id_.assign(value.data(), value.size());
+      }
+    } else if (field == "retry") {
+      if (!value.empty() && std::all_of(value.begin(), value.end(),
+                                        [](char c) { return c >= '0' && c <= '9'; })) {
+        retry_ms_ = std::strtol(std::string(value).c_str(), nullptr, 10);
+      }
+    }
+  }
+
+  std::string buffer_;
+  size_t read_ = 0;
+  bool skip_lf_ = false;
+  bool bom_checked_ = false;
+  std::string data_;
+  std::string type_;
+  std::string last_event_id_;
+  long retry_ms_ = -1;
+};
+
+// 4-byte big-endian length, then that much MessagePack. Only frames split
+// across chunks are copied.
+class LengthPrefixedFramer {
+ public:
+  static constexpr uint32_t kMaxFrameSize = 1024 * 1024;
+
+  // Returns false on a frame larger than kMaxFrameSize; the stream cannot be
+  // resynchronized after that and should be dropped.
+  template <typename Handler>
+  bool Feed(const char *bytes, size_t size, Handler &&on_frame) {
+    size_t pos = 0;
+    while (pos < size) {
+      if (buffer_.empty() && size - pos >= 4) {
+        uint32_t length = ReadLength(bytes + pos);
+        if (length > kMaxFrameSize) {
+          return false;
+        }
+        if (size - pos - 4 >= length) {
+          on_frame(std::string_view(bytes + pos + 4, length));
+          pos += 4 + length;
+          continue;
+        }
+      }
+      size_t wanted = buffer_.size() < 4 ? 4 - buffer_.size()
+                                         : 4 + ReadLength(buffer_.data()) - buffer_.size();
+      size_t take = std::min(wanted, size - pos);
+      buffer_.append(bytes + pos, take);
+      pos += take;
+      if (buffer_.size() < 4) {
+        continue;
+      }
+      uint32_t length = ReadLength(buffer_.data());
+      if (length > kMaxFrameSize) {
+        return false;
+      }
+      if (buffer_.size() == 4 + static_cast<size_t>(length)) {
+        on_frame(std::string_view(buffer_).substr(4));
+        buffer_.clear();
+      }
+    }
+    return true;
+  }
+
+ private:
+  static uint32_t ReadLength(const char *bytes) {
+    const unsigned char *b = reinterpret_cast<const unsigned char *>(bytes);
+    return (uint32_t(b[0]) << 24) | (uint32_t(b[1]) << 16) | (uint32_t(b[2]) << 8) | uint32_t(b[3]);
+  }
+
+  std::string buffer_;
+};
+
+// How the event feed is received. kAuto asks for /stream and falls back to
+// /sse when the server does not answer with MessagePack frames.
+enum class StreamTransport { kAuto, kSse, kMsgpack };
+
+// Exponential backoff with jitter, restarted after kStableMs up; an SSE retry
+// field replaces kBaseDelayMs. One supervisor per connection.
+class ReconnectSupervisor {
+ public:
+  static constexpr uint64_t kFirstDelayMs = 250;
+  static constexpr uint64_t kBaseDelayMs = 1000;
+  static constexpr uint64_t kMaxDelayMs = 60000;
+  static constexpr uint64_t kStableMs = 30000;
+
+  ReconnectSupervisor(const char *name, size_t slot, AppState *state, std::mutex *mutex)
+      : slot_(slot), state_(state), mutex_(mutex), rng_(std::random_device{}()) {
+    health_.name = name;
+    Publish();
+  }
+
+  void Connected() {
+    health_.connected = true;
+    health_.connects++;
+    health_.connected_since_ms = NowMs();
+    Publish();
+  }
+
+  void SetBaseDelay(uint64_t delay_ms) {
+    base_delay_ms_ = std::clamp(delay_ms, kFirstDelayMs, kMaxDelayMs);
+  }
+
+  uint64_t Disconnected() {
+    if (health_.connected) {
+      health_.disconnects++;
+      if (NowMs() - health_.connected_since_ms >= kStableMs) {
+        health_.failures = 0;
+      }
+    }
+    uint64_t delay = health_.failures == 0
+                         ? std::min(kFirstDelayMs, base_delay_ms_)
+                         : std::min(kMaxDelayMs, base_delay_ms_ << std::min(health_.failures - 1, 16u));
+    // Half fixed, half random, so clients dropped together spread out.
+    delay = delay / 2 + std::uniform_int_distribution<uint64_t>(0, delay / 2)(rng_);
+    health_.failures++;
+    health_.connected = false;
+    health_.retry_delay_ms = delay;
+    Publish();
+    return delay;
+  }
+
+ private:
+  void Publish() {
+    std::lock_guard<std::mutex> lock(*mutex_);
+    state_->connections[slot_] = health_;
+  }
+
+  size_t slot_;
+  AppState *state_;
+  std::mutex *mutex_;
+  std::mt19937 rng_;
+  uint64_t base_delay_ms_ = kBaseDelayMs;
+  ConnectionHealth health_;
+};
 
 struct SseStreamState {
-  std::string buffer;
+  SseFramer framer;
+  LengthPrefixedFramer binary_framer;
+  SseMessage message;
   std::mutex *mutex = nullptr;
   AppState *state = nullptr;
+  ReconnectSupervisor *supervisor = nullptr;
+  CURL *curl = nullptr;
+  bool binary = false;
+  bool checked_content_type = false;
+  bool rejected = false;
+  size_t body_bytes = 0;
+  uint64_t last_size_log_ms = 0;
+  // Id of the last /stream message; /sse ids are tracked by the framer.
+  std::string last_event_id;
 };
 
-void HandlePacketMessage(AppState &state, const std::string &payload) {
-  try {
-    if (payload.size() > 1024 * 1024 || !LooksLikeJsonObject(payload)) {
+// A coalesced pulse replays its run from the source and burns brighter.
+void RefreshPulse(AnimationRing<MovingPulse, kMaxPulses> &pulses, uint64_t key, uint64_t now) {
+  for (size_t i = pulses.size(); i-- > 0;) {
+    MovingPulse &pulse = pulses[i];
+    if (pulse.key == key) {
+      pulse.start_time_ms = now;
+      pulse.intensity = std::min(kMaxAnimationIntensity, pulse.intensity + kCoalesceIntensityStep);
       return;
     }
-    auto root = ParseJson(payload);
-    if (root.is_discarded() || !root.is_object()) {
+  }
+}
+
+// A coalesced path that has finished drawing restarts its fade from full,
+// which extends its lifetime, and burns brighter.
+void RefreshPath(PathPool &paths, uint64_t key, uint64_t now) {
+  for (size_t i = paths.size(); i-- > 0;) {
+    PathAnimation &path = paths[i];
+    if (path.key == key) {
+      uint64_t duration = static_cast<uint64_t>(path.duration_ms);
+      uint64_t drawn_at = now > duration ? now - duration : 0;
+      path.start_time_ms = std::max(path.start_time_ms, drawn_at);
+      path.intensity = std::min(kMaxAnimationIntensity, path.intensity + kCoalesceIntensityStep);
       return;
     }
+  }
+}
 
-    std::string direction = JsonGetString(root, "direction");
-    std::string sender = JsonGetString(root, "sender_name");
+void HandlePacketMessage(AppState &state, const DecodedEvent &event) {
+  try {
+    std::string direction(event.GetString(DecodedEvent::kDirection));
+    std::string_view sender = event.GetString(DecodedEvent::kSenderName);
     if (sender.empty()) {
-      sender = JsonGetString(root, "group_sender_name");
+      sender = event.GetString(DecodedEvent::kGroupSenderName);
     }
     if (sender.empty()) {
-      sender = JsonGetString(root, "advert_name");
+      sender = event.GetString(DecodedEvent::kAdvertName);
     }
-    std::string origin = JsonGetString(root, "origin");
+    std::string_view origin = event.GetString(DecodedEvent::kOrigin);
     if (sender.empty()) {
       sender = "unknown";
     }
@@ -625,29 +3685,41 @@ void HandlePacketMessage(AppState &state, const std::string &payload) {
 
     const Node *src_node = nullptr;
     const Node *dst_node = nullptr;
-    auto src_hash_it = root.find("src_hash");
-    auto dst_hash_it = root.find("dst_hash");
-    if (src_hash_it != root.end() && dst_hash_it != root.end()) {
-      if (src_hash_it->is_number() && dst_hash_it->is_number()) {
-        int src_hash = src_hash_it->get<int>();
-        int dst_hash = dst_hash_it->get<int>();
-        auto src_it = state.node_hash_index.find(src_hash);
-        auto dst_it = state.node_hash_index.find(dst_hash);
-        if (src_it != state.node_hash_index.end()) {
-          src_node = &state.nodes[src_it->second];
+    using Kind = DecodedEvent::Value::Kind;
+    const DecodedEvent::Value &src_hash_value = event.fields[DecodedEvent::kSrcHash];
+    const DecodedEvent::Value &dst_hash_value = event.fields[DecodedEvent::kDstHash];
+    if (src_hash_value.kind != Kind::kMissing && dst_hash_value.kind != Kind::kMissing) {
+      if (src_hash_value.kind == Kind::kNumber && dst_hash_value.kind == Kind::kNumber) {
+        int src_hash = static_cast<int>(src_hash_value.number);
+        int dst_hash = static_cast<int>(dst_hash_value.number);
+        const NodeStore &store = *state.node_store;
+        auto src_it = store.node_hash_index.find(src_hash);
+        auto dst_it = store.node_hash_index.find(dst_hash);
+        if (src_it != store.node_hash_index.end()) {
+          src_node = &store.nodes[src_it->second];
         }
-        if (dst_it != state.node_hash_index.end()) {
-          dst_node = &state.nodes[dst_it->second];
+        if (dst_it != store.node_hash_index.end()) {
+          dst_node = &store.nodes[dst_it->second];
         }
-      } else if (src_hash_it->is_string() && dst_hash_it->is_string()) {
-        std::string src_prefix = src_hash_it->get<std::string>();
-        std::string dst_prefix = dst_hash_it->get<std::string>();
-        src_node = FindNodeByPublicKeyPrefix(state.nodes, src_prefix);
-        dst_node = FindNodeByPublicKeyPrefix(state.nodes, dst_prefix);
+      } else if (src_hash_value.kind == Kind::kString && dst_hash_value.kind == Kind::kString) {
+        src_node = FindNodeByPublicKeyPrefix(*state.node_store, event.String(src_hash_value));
+        dst_node = FindNodeByPublicKeyPrefix(*state.node_store, event.String(dst_hash_value));
       }
     }
 
     if (src_node && dst_node && src_node->has_position && dst_node->has_position) {
+      // Keyed by node id, so the key survives a refresh that reorders nodes.
+      // Bit 63 stays clear for path keys.
+      uint64_t key = (static_cast<uint64_t>(static_cast<uint32_t>(src_node->id) & 0x7fffffffu) << 32) |
+                     static_cast<uint32_t>(dst_node->id);
+      uint64_t now = NowMs();
+      Admission admission = state.admission.Decide(key, now);
+      if (admission == Admission::kCoalesced) {
+        RefreshPulse(state.pulses, key, now);
+      }
+      if (admission != Admission::kAdmitted) {
+        return;
+      }
       MovingPulse pulse;
       double sx = 0.0;
       double sy = 0.0;
@@ -659,74 +3731,95 @@ void HandlePacketMessage(AppState &state, const std::string &payload) {
       pulse.start.y = static_cast<float>(sy);
       pulse.end.x = static_cast<float>(ex);
       pulse.end.y = static_cast<float>(ey);
-      pulse.start_time_ms = NowMs();
-      state.pulses.push_back(pulse);
+      pulse.start_time_ms = now;
+      pulse.key = key;
+      state.pulses.Push() = pulse;
     }
   } catch (const std::exception &e) {
     std::cerr << "Packet parse error: " << e.what() << "\n";
   }
 }
 
-void HandlePropagationMessage(AppState &state, const std::string &payload) {
+void HandlePropagationMessage(AppState &state, const DecodedEvent &event,
+                              std::string_view payload) {
   static int propagation_seen = 0;
   try {
-    if (payload.size() > 1024 * 1024 || !LooksLikeJsonObject(payload)) {
-      return;
-    }
-    auto root = ParseJson(payload);
-    if (root.is_discarded() || !root.is_object()) {
-      return;
-    }
-    std::string type = JsonGetString(root, "type");
-    if (type != "propagation.path") {
+    if (event.GetString(DecodedEvent::kType) != "propagation.path") {
       return;
     }
     propagation_seen++;
     if (propagation_seen <= 5 || propagation_seen % 50 == 0) {
       std::cerr << "Propagation event received (" << propagation_seen << ")\n";
     }
-    if (propagation_seen <= 2) {
-      std::string preview = payload.substr(0, 400);
+    if (propagation_seen <= 2 && !payload.empty()) {
+      std::string_view preview = payload.substr(0, 400);
       std::cerr << "Propagation payload preview: " << preview << "\n";
     }
 
-    auto path_it = root.find("path");
-    if (path_it == root.end() || !path_it->is_object()) {
-      return;
-    }
-    auto nodes_it = path_it->find("nodes");
-    if (nodes_it == path_it->end() || !nodes_it->is_array()) {
-      return;
-    }
-    if (nodes_it->size() < 2) {
+    if (!event.has_path_nodes || event.path_node_total < 2) {
       return;
     }
 
-    PathAnimation anim;
-    anim.start_time_ms = NowMs();
-    anim.duration_ms = std::max(800.0f, static_cast<float>(nodes_it->size()) * 250.0f);
+    std::array<SDL_FPoint, kMaxPathHops> points;
+    size_t point_count = 0;
+    // FNV-1a over the matched node ids; identical paths share a key. The top
+    // bit keeps path keys apart from src->dst pulse keys.
+    uint64_t path_key = 14695981039346656037ull;
 
-    for (const auto &node_value : *nodes_it) {
-      const Node *node = nullptr;
-      if (node_value.is_number()) {
-        int node_hash = node_value.get<int>();
-        auto it = state.node_hash_index.find(node_hash);
-        if (it != state.node_hash_index.end()) {
-          node = &state.nodes[it->second];
+    const NodeStore &store = *state.node_store;
+    using Kind = DecodedEvent::Value::Kind;
+    // Enriched hops carry coordinates; unresolved ones are looked up locally.
+    bool resolved_hops = event.HasResolvedHops();
+    for (size_t i = 0; i < event.path_node_count; i++) {
+      double lat = 0.0;
+      double lon = 0.0;
+      uint64_t id = 0;
+      const DecodedEvent::Value *hop_lat =
+          resolved_hops ? &event.hops[DecodedEvent::kHopLats][i] : nullptr;
+      const DecodedEvent::Value *hop_lon =
+          resolved_hops ? &event.hops[DecodedEvent::kHopLons][i] : nullptr;
+      if (hop_lat && hop_lat->kind == Kind::kNumber && hop_lon->kind == Kind::kNumber) {
+        lat = hop_lat->real;
+        lon = hop_lon->real;
+        id = static_cast<uint64_t>(event.hops[DecodedEvent::kHopIds][i].number);
+      } else {
+        const DecodedEvent::Value &node_value = event.path_nodes[i];
+        const Node *node = nullptr;
+        if (node_value.kind == Kind::kNumber) {
+          int node_hash = static_cast<int>(node_value.number);
+          auto it = store.node_hash_index.find(node_hash);
+          if (it != store.node_hash_index.end()) {
+            node = &store.nodes[it->second];
+          }
+        } else if (node_value.kind == Kind::kString) {
+          node = ResolvePropagationToken(store, state.token_cache, event.String(node_value));
         }
-      } else if (node_value.is_string()) {
-        node = FindNodeByPropagationToken(state.nodes, node_value.get<std::string>());
-      }
-      if (node && node->has_position) {
-        double px = 0.0;
-        double py = 0.0;
-        LatLonToWorldPixel(node->lat, node->lon, kDefaultZoom, &px, &py);
-        SDL_FPoint pt{static_cast<float>(px), static_cast<float>(py)};
-        anim.points.push_back(pt);
+        if (!node || !node->has_position) {
+          continue;
+        }
+        lat = node->lat;
+        lon = node->lon;
+        id = static_cast<uint64_t>(node->id);
       }
+      double px = 0.0;
+      double py = 0.0;
+      LatLonToWorldPixel(lat, lon, kDefaultZoom, &px, &py);
+      points[point_count++] = SDL_FPoint{static_cast<float>(px), static_cast<float>(py)};
+      path_key = (path_key ^ id) * 1099511628211ull;
     }
+    path_key |= 1ull << 63;
 
-    if (anim.points.size() >= 2) {
+    uint64_t now = NowMs();
+    if (point_count >= 2) {
+      Admission admission = state.admission.Decide(path_key, now);
+      if (admission == Admission::kCoalesced) {
+        RefreshPath(state.paths, path_key, now);
+      }
+      if (admission != Admission::kAdmitted) {
+        return;
+      }
+    }
+    if (point_count >= 2) {
       static const SDL_Color colors[] = {
         {59, 130, 246, 255},   // blue
         {250, 204, 21, 255},   // yellow
@@ -741,150 +3834,785 @@ void HandlePropagationMessage(AppState &state, const std::string &payload) {
         seed = static_cast<uint32_t>(NowMs());
       }
       seed = seed * 1664525u + 1013904223u;
+      PathAnimation &anim = state.paths.Push(points.data(), point_count);
+      anim.start_time_ms = now;
+      anim.key = path_key;
+      anim.duration_ms = std::max(800.0f, static_cast<float>(event.path_node_total) * 250.0f);
       anim.color = colors[seed % (sizeof(colors) / sizeof(colors[0]))];
       anim.width = 3.5f;
-      state.paths.push_back(anim);
       if (propagation_seen <= 5 || propagation_seen % 50 == 0) {
-        std::cerr << "Propagation path points: " << anim.points.size() << "\n";
+        std::cerr << "Propagation path points: " << point_count << "\n";
       }
     } else if (propagation_seen <= 5 || propagation_seen % 50 == 0) {
-      std::cerr << "Propagation path dropped (matched points: " << anim.points.size() << ")\n";
+      std::cerr << "Propagation path dropped (matched points: " << point_count << ")\n";
     }
   } catch (const std::exception &e) {
     std::cerr << "Propagation parse error: " << e.what() << "\n";
   }
 }
 
-void HandleSseMessage(AppState &state, const std::string &json) {
+void HandleSseMessage(AppState &state, const SseMessage &message) {
   try {
-    if (json.size() > 1024 * 1024 || !LooksLikeJsonObject(json)) {
-      return;
+    switch (message.type) {
+      case SseMessage::Type::kStatus:
+        if (!message.status.empty()) {
+          state.connection_status = message.status;
+        }
+        break;
+      case SseMessage::Type::kPing:
+        state.last_update = FormatTimeNow();
+        break;
+      case SseMessage::Type::kPacket:
+        HandlePacketMessage(state, message.event);
+        state.last_update = FormatTimeNow();
+        break;
+      case SseMessage::Type::kPropagation:
+        HandlePropagationMessage(state, message.event, message.document);
+        state.last_update = FormatTimeNow();
+        break;
+      case SseMessage::Type::kBatch:
+        for (size_t i = 0; i < message.batch_size; i++) {
+          HandleSseMessage(state, message.batch[i]);
+        }
+        break;
+      case SseMessage::Type::kReplayGap:
+        state.stream_gaps++;
+        if (message.missed >= 0) {
+          std::cerr << "Event stream gap: " << message.missed << " events lost while disconnected\n";
+        } else {
+          std::cerr << "Event stream gap: server could not tell how many events were lost\n";
+        }
+        break;
+      case SseMessage::Type::kUnknown:
+        break;
     }
-    std::string type = ExtractJsonStringField(json, "type");
+  } catch (const std::exception &e) {
+    std::cerr << "SSE parse error: " << e.what() << "\n";
+  }
+}
 
-    if (type == "statusUpdate" || type == "connected") {
-      std::string status = UnescapeJsonString(ExtractJsonStringField(json, "connectionStatus"));
-      if (!status.empty()) {
-        state.connection_status = status;
-      }
+// Decoding touches only the stream's own buffers, so it runs before the
+// state lock is taken; a batch frame is handled under a single lock.
+template <typename Decode>
+void DispatchStreamFrame(SseStreamState *stream, std::string_view frame, Decode decode) {
+  try {
+    if (!decode(frame, &stream->message)) {
       return;
     }
+    std::lock_guard<std::mutex> lock(*stream->mutex);
+    HandleSseMessage(*stream->state, stream->message);
+  } catch (const std::exception &e) {
+    std::cerr << "SSE handler error: " << e.what() << "\n";
+  } catch (...) {
+    std::cerr << "SSE handler error: unknown exception\n";
+  }
+}
+
+size_t CurlWriteSse(void *contents, size_t size, size_t nmemb, void *userp) {
+  size_t total = size * nmemb;
+  SseStreamState *stream = static_cast<SseStreamState *>(userp);
+  const char *bytes = static_cast<const char *>(contents);
+  if (stream->body_bytes == 0 && stream->supervisor) {
+    // The first body bytes of a successful response mark the connection as
+    // up; error pages do not count.
+    long status = 0;
+    curl_easy_getinfo(stream->curl, CURLINFO_RESPONSE_CODE, &status);
+    if (status == 200) {
+      stream->supervisor->Connected();
+    }
+  }
+  stream->body_bytes += total;
+  uint64_t now = NowMs();
+  if (now - stream->last_size_log_ms >= kStatsLogIntervalMs) {
+    stream->last_size_log_ms = now;
+    curl_off_t wire_bytes = 0;
+    curl_easy_getinfo(stream->curl, CURLINFO_SIZE_DOWNLOAD_T, &wire_bytes);
+    LogTransferSize("Event stream", wire_bytes, stream->body_bytes);
+  }
+  if (!stream->binary) {
+    stream->framer.Feed(bytes, total, [stream](const SseFramer::Event &event) {
+      DispatchStreamFrame(stream, event.data, DecodeSseMessage);
+    });
+    return total;
+  }
+  if (!stream->checked_content_type) {
+    // Anything but MessagePack aborts the transfer; Finished decides on the
+    // /sse fallback from the status.
+    stream->checked_content_type = true;
+    char *content_type = nullptr;
+    curl_easy_getinfo(stream->curl, CURLINFO_CONTENT_TYPE, &content_type);
+    if (!content_type || std::strncmp(content_type, "application/msgpack", 19) != 0) {
+      stream->rejected = true;
+      return 0;
+    }
+  }
+  bool ok = stream->binary_framer.Feed(bytes, total, [stream](std::string_view frame) {
+    DispatchStreamFrame(stream, frame, DecodeBinaryMessage);
+    if (!stream->message.id.empty()) {
+      stream->last_event_id = stream->message.id;
+    }
+  });
+  if (!ok) {
+    std::cerr << "Stream frame too large, reconnecting\n";
+    return 0;
+  }
+  return total;
+}
+
+StreamTransport ParseStreamTransport(const char *value) {
+  std::string name = value ? value : "";
+  if (name == "sse") {
+    return StreamTransport::kSse;
+  }
+  if (name == "msgpack") {
+    return StreamTransport::kMsgpack;
+  }
+  if (!name.empty() && name != "auto") {
+    std::cerr << "Unknown MESHCORETEL_TRANSPORT '" << name << "', using auto\n";
+  }
+  return StreamTransport::kAuto;
+}
+
+struct StreamOptions {
+  StreamTransport transport = StreamTransport::kAuto;
+  bool enrich_paths = true;
+  bool batch_events = true;
+  // Read the upstream WebSockets directly (see RunWsIngestThread); the
+  // server then only serves /api/*.
+  bool direct_ingest = false;
+  std::string packets_ws_url = "wss://www.meshcoretel.ru/ws/packets";
+  std::string propagations_ws_url = "wss://www.meshcoretel.ru/ws/propagations";
+};
+
+// Reads a boolean MESHCORETEL_* switch; anything but "0" enables it.
+bool EnvFlag(const char *name, bool fallback) {
+  const char *value = std::getenv(name);
+  return value ? std::string(value) != "0" : fallback;
+}
+
+std::string StreamQuery(const StreamOptions &options) {
+  std::string query;
+  if (options.enrich_paths) {
+    query += "enrich=1";
+  }
+  if (options.batch_events) {
+    query += query.empty() ? "batch=1" : "&batch=1";
+  }
+  return query.empty() ? query : "?" + query;
+}
+
+// The /sse or /stream connection. Last-Event-ID is sent on reconnect so the
+// server replays what was missed.
+class EventStreamClient {
+ public:
+  EventStreamClient(NetworkReactor *reactor, ServerEndpoint endpoint, StreamOptions options,
+                    AppState *state, std::mutex *mutex)
+      : reactor_(reactor),
+        endpoint_(std::move(endpoint)),
+        options_(std::move(options)),
+        state_(state),
+        mutex_(mutex),
+        binary_(options_.transport != StreamTransport::kSse),
+        supervisor_("event stream", 0, state, mutex) {}
+
+  ~EventStreamClient() {
+    curl_slist_free_all(headers_);
+    if (curl_) {
+      curl_easy_cleanup(curl_);
+    }
+  }
 
-    if (type == "ping") {
-      state.last_update = FormatTimeNow();
+  // Reactor thread only.
+  void Connect() {
+    if (curl_) {
+      curl_easy_reset(curl_);
+    } else if (!(curl_ = curl_easy_init())) {
+      std::cerr << "SSE init failed\n";
+      Retry();
       return;
     }
+    ConfigureSharedHandle(curl_);
+    url_ = endpoint_.base_url + (binary_ ? "/stream" : "/sse") + StreamQuery(options_);
+    std::cerr << "SSE connect: " << url_;
+    if (!endpoint_.unix_socket.empty()) {
+      std::cerr << " via " << endpoint_.unix_socket;
+    }
+    std::cerr << "\n";
+    stream_ = std::make_unique<SseStreamState>();
+    stream_->mutex = mutex_;
+    stream_->state = state_;
+    stream_->supervisor = &supervisor_;
+    stream_->curl = curl_;
+    stream_->binary = binary_;
+    stream_->last_size_log_ms = NowMs();
 
-    if (type == "packet" || type == "propagation") {
-      std::string data = UnescapeJsonString(ExtractJsonStringField(json, "data"));
-      if (data.empty()) {
-        return;
-      }
-      std::string payload = data;
-      if (type == "packet") {
-        HandlePacketMessage(state, payload);
-      } else {
-        HandlePropagationMessage(state, payload);
-      }
-      state.last_update = FormatTimeNow();
+    headers_ = curl_slist_append(
+        nullptr, binary_ ? "Accept: application/msgpack" : "Accept: text/event-stream");
+    if (!last_event_id_.empty()) {
+      headers_ = curl_slist_append(headers_, ("Last-Event-ID: " + last_event_id_).c_str());
+    }
+    curl_easy_setopt(curl_, CURLOPT_URL, url_.c_str());
+    ApplyServerEndpoint(curl_, endpoint_);
+    curl_easy_setopt(curl_, CURLOPT_HTTPHEADER, headers_);
+    // The server keeps one deflate context per client and flushes it after
+    // every message, so events are still delivered as they happen.
+    curl_easy_setopt(curl_, CURLOPT_ACCEPT_ENCODING, "");
+    curl_easy_setopt(curl_, CURLOPT_WRITEFUNCTION, CurlWriteSse);
+    curl_easy_setopt(curl_, CURLOPT_WRITEDATA, stream_.get());
+    curl_easy_setopt(curl_, CURLOPT_USERAGENT, "meshcoretel-native/1.0");
+    curl_easy_setopt(curl_, CURLOPT_TIMEOUT, 0L);
+    curl_easy_setopt(curl_, CURLOPT_CONNECTTIMEOUT, 5L);
+    curl_easy_setopt(curl_, CURLOPT_NOPROGRESS, 1L);
+    reactor_->AddTransfer(curl_, [this](CURLcode res) { Finished(res); });
+  }
+
+ private:
+  void Finished(CURLcode res) {
+    CountConnectionReuse(curl_);
+    curl_off_t wire_bytes = 0;
+    curl_easy_getinfo(curl_, CURLINFO_SIZE_DOWNLOAD_T, &wire_bytes);
+    LogTransferSize("Event stream", wire_bytes, stream_->body_bytes);
+    const std::string &received_id =
+        binary_ ? stream_->last_event_id : stream_->framer.last_event_id();
+    if (!received_id.empty()) {
+      last_event_id_ = received_id;
+    }
+    if (!binary_ && stream_->framer.retry_ms() >= 0) {
+      supervisor_.SetBaseDelay(static_cast<uint64_t>(stream_->framer.retry_ms()));
+    }
+    // The handle outlives this transfer, so it must stop pointing at the
+    // header list before the list is freed.
+    curl_easy_setopt(curl_, CURLOPT_HTTPHEADER, nullptr);
+    curl_slist_free_all(headers_);
+    headers_ = nullptr;
+    // Only a server that does not know /stream, or will not serve it as
+    // MessagePack, means falling back; other failures (5xx from a proxy, a
+    // dropped connection) go through the usual reconnect.
+    long status = 0;
+    curl_easy_getinfo(curl_, CURLINFO_RESPONSE_CODE, &status);
+    if (binary_ && options_.transport == StreamTransport::kAuto &&
+        (status == 404 || status == 406 || status == 415)) {
+      std::cerr << "Server has no MessagePack stream (HTTP " << status << "), using /sse\n";
+      binary_ = false;
+      Connect();
       return;
     }
-  } catch (const std::exception &e) {
-    std::cerr << "SSE parse error: " << e.what() << "\n";
+    if (stream_->rejected) {
+      std::cerr << "SSE error: " << url_ << " answered HTTP " << status
+                << " without MessagePack frames\n";
+    } else if (res != CURLE_OK) {
+      std::cerr << "SSE error: " << curl_easy_strerror(res) << "\n";
+    }
+    Retry();
   }
+
+  void Retry() {
+    uint64_t delay_ms = supervisor_.Disconnected();
+    std::cerr << "SSE disconnected, retrying in " << delay_ms << " ms...\n";
+    reactor_->Schedule(delay_ms, [this]() { Connect(); });
+  }
+
+  NetworkReactor *reactor_;
+  ServerEndpoint endpoint_;
+  StreamOptions options_;
+  AppState *state_;
+  std::mutex *mutex_;
+  bool binary_;
+  ReconnectSupervisor supervisor_;
+  CURL *curl_ = nullptr;
+  curl_slist *headers_ = nullptr;
+  std::string url_;
+  std::string last_event_id_;
+  std::unique_ptr<SseStreamState> stream_;
+};
+
+// Direct ingest: reads the upstream WebSockets and decodes each text message
+// as an event document. Needs libcurl 7.86+ with ws/wss support.
+#if LIBCURL_VERSION_NUM >= 0x075600
+// Later libcurl releases made curl_ws_recv's frame argument const; deducing
+// it builds against both.
+template <typename Frame>
+CURLcode WsRecv(CURLcode (*recv_fn)(CURL *, void *, size_t, size_t *, Frame **), CURL *curl,
+                void *buffer, size_t size, size_t *received, const curl_ws_frame **meta) {
+  Frame *frame = nullptr;
+  CURLcode res = recv_fn(curl, buffer, size, received, &frame);
+  *meta = frame;
+  return res;
 }
+#endif
 
-size_t CurlWriteSse(void *contents, size_t size, size_t nmemb, void *userp) {
-  size_t total = size * nmemb;
-  SseStreamState *stream = static_cast<SseStreamState *>(userp);
-  stream->buffer.append(static_cast<char *>(contents), total);
+bool WebSocketsSupported() {
+#if LIBCURL_VERSION_NUM >= 0x075600
+  const curl_version_info_data *info = curl_version_info(CURLVERSION_NOW);
+  for (const char *const *protocol = info->protocols; protocol && *protocol; protocol++) {
+    if (std::strcmp(*protocol, "ws") == 0) {
+      return true;
+    }
+  }
+#endif
+  return false;
+}
 
-  size_t pos = 0;
-  while ((pos = stream->buffer.find('\n')) != std::string::npos) {
-    std::string line = stream->buffer.substr(0, pos);
-    stream->buffer.erase(0, pos + 1);
-    if (line.rfind("data: ", 0) == 0) {
-      std::string payload = line.substr(6);
-      std::lock_guard<std::mutex> lock(*stream->mutex);
-      try {
-        HandleSseMessage(*stream->state, payload);
-      } catch (const std::exception &e) {
-        std::cerr << "SSE handler error: " << e.what() << "\n";
-      } catch (...) {
-        std::cerr << "SSE handler error: unknown exception\n";
-      }
+void SetConnectionStatus(AppState *state, std::mutex *mutex, const std::string &status) {
+  std::lock_guard<std::mutex> lock(*mutex);
+  state->connection_status = status;
+}
+
+// Set once at shutdown; wakes threads waiting out a reconnect delay.
+class StopSignal {
+ public:
+  void Set() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopped_ = true;
     }
+    changed_.notify_all();
   }
 
-  return total;
+  bool stopped() const { return stopped_.load(std::memory_order_relaxed); }
+
+  bool WaitFor(uint64_t delay_ms) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    return changed_.wait_for(lock, std::chrono::milliseconds(delay_ms),
+                             [this]() { return stopped(); });
+  }
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable changed_;
+  std::atomic<bool> stopped_{false};
+};
+
+#if LIBCURL_VERSION_NUM >= 0x075600
+int CurlStopProgress(void *userp, curl_off_t, curl_off_t, curl_off_t, curl_off_t) {
+  return static_cast<const StopSignal *>(userp)->stopped() ? 1 : 0;
 }
+#endif
 
-void RunSseThread(const std::string &base_url, AppState *state, std::mutex *mutex) {
-  std::string url = base_url + "/sse";
-  while (true) {
+// Reads one upstream WebSocket of `type` messages until `stop`, polling with a
+// 1 s timeout.
+void RunWsIngestThread(const std::string &url, SseMessage::Type type, AppState *state,
+                       std::mutex *mutex, StopSignal *stop) {
+#if LIBCURL_VERSION_NUM >= 0x075600
+  constexpr size_t kMaxMessageSize = 1024 * 1024;
+  std::vector<char> chunk(64 * 1024);
+  SseMessage message;
+  bool packets = type == SseMessage::Type::kPacket;
+  ReconnectSupervisor supervisor(packets ? "packets WebSocket" : "propagations WebSocket",
+                                 packets ? 0 : 1, state, mutex);
+  while (!stop->stopped()) {
     try {
-      CURL *curl = curl_easy_init();
+      CURL *curl = t_curl.Acquire();
       if (!curl) {
-        std::cerr << "SSE init failed, retrying...\n";
-        std::this_thread::sleep_for(std::chrono::seconds(5));
+        std::cerr << "WebSocket init failed, retrying...\n";
+        stop->WaitFor(supervisor.Disconnected());
         continue;
       }
-      std::cerr << "SSE connect: " << url << "\n";
-      SseStreamState stream;
-      stream.mutex = mutex;
-      stream.state = state;
-
+      std::cerr << "WebSocket connect: " << url << "\n";
       curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-      curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, CurlWriteSse);
-      curl_easy_setopt(curl, CURLOPT_WRITEDATA, &stream);
+      // 2 = connect and finish the WebSocket upgrade, then hand the
+      // connection to curl_ws_recv.
+      curl_easy_setopt(curl, CURLOPT_CONNECT_ONLY, 2L);
       curl_easy_setopt(curl, CURLOPT_USERAGENT, "meshcoretel-native/1.0");
-      curl_easy_setopt(curl, CURLOPT_TIMEOUT, 0L);
       curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 5L);
-      curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 1L);
+      curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+      curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, CurlStopProgress);
+      curl_easy_setopt(curl, CURLOPT_XFERINFODATA, stop);
       CURLcode res = curl_easy_perform(curl);
+      curl_socket_t socket = CURL_SOCKET_BAD;
+      if (res == CURLE_OK) {
+        res = curl_easy_getinfo(curl, CURLINFO_ACTIVESOCKET, &socket);
+      }
+      if (res == CURLE_OK) {
+        supervisor.Connected();
+        SetConnectionStatus(state, mutex, "Connected (direct)");
+      }
+      bool oversized = false;
+      message.document.clear();
+      while (res == CURLE_OK && !stop->stopped()) {
+        size_t received = 0;
+        const curl_ws_frame *meta = nullptr;
+        res = WsRecv(curl_ws_recv, curl, chunk.data(), chunk.size(), &received, &meta);
+        if (res == CURLE_AGAIN) {
+          pollfd fd = {socket, POLLIN, 0};
+          poll(&fd, 1, 1000);
+          res = CURLE_OK;
+          continue;
+        }
+        if (res != CURLE_OK || !meta || (meta->flags & CURLWS_CLOSE)) {
+          break;
+        }
+        // libcurl answers pings itself.
+        if (!(meta->flags & (CURLWS_TEXT | CURLWS_BINARY | CURLWS_CONT))) {
+          continue;
+        }
+        if (!oversized && message.document.size() + received <= kMaxMessageSize) {
+          message.document.append(chunk.data(), received);
+        } else {
+          oversized = true;
+        }
+        if (meta->bytesleft > 0 || (meta->flags & CURLWS_CONT)) {
+          continue;
+        }
+        if (oversized) {
+          std::cerr << "WebSocket message too large, skipped\n";
+        } else if (DecodeEventDocument(message.document, &message.event)) {
+          message.type = type;
+          std::lock_guard<std::mutex> lock(*mutex);
+          HandleSseMessage(*state, message);
+        }
+        oversized = false;
+        message.document.clear();
+      }
+      CountConnectionReuse(curl);
+      if (stop->stopped()) {
+        break;
+      }
       if (res != CURLE_OK) {
-        std::cerr << "SSE error: " << curl_easy_strerror(res) << "\n";
+        std::cerr << "WebSocket error: " << url << ": " << curl_easy_strerror(res) << "\n";
       }
-      curl_easy_cleanup(curl);
-      std::cerr << "SSE disconnected, retrying...\n";
-      std::this_thread::sleep_for(std::chrono::seconds(5));
+      SetConnectionStatus(state, mutex, "Reconnecting (direct)");
+      uint64_t delay_ms = supervisor.Disconnected();
+      std::cerr << "WebSocket disconnected: " << url << ", retrying in " << delay_ms << " ms...\n";
+      stop->WaitFor(delay_ms);
     } catch (const std::exception &e) {
-      std::cerr << "SSE thread error: " << e.what() << "\n";
-      std::this_thread::sleep_for(std::chrono::seconds(5));
-    } catch (...) {
-      std::cerr << "SSE thread error: unknown exception\n";
-      std::this_thread::sleep_for(std::chrono::seconds(5));
+      std::cerr << "WebSocket thread error: " << e.what() << "\n";
+      stop->WaitFor(supervisor.Disconnected());
     }
   }
+  // The handle goes now, not at thread exit, so it is gone by the time
+  // main frees the share.
+  t_curl.Release();
+#else
+  (void)url;
+  (void)type;
+  (void)state;
+  (void)mutex;
+  (void)stop;
+#endif
 }
 
-void FetchNodesLoop(const std::string &base_url, AppState *state, std::mutex *mutex) {
-  while (true) {
-    try {
-      std::string response = HttpGet(base_url + "/api/adverts");
-      if (!response.empty()) {
-        std::vector<Node> nodes = ParseNodesJson(response);
-        if (!nodes.empty()) {
-          std::lock_guard<std::mutex> lock(*mutex);
-          state->nodes = std::move(nodes);
-          UpdateNodeIndex(*state);
-          state->last_update = FormatTimeNow();
-          std::cerr << "Nodes updated: " << state->nodes.size() << "\n";
+void LogStringArenaStats(const StringArena::Stats &stats) {
+  std::cerr << "Node strings: " << stats.interned << " interned, " << stats.reused
+            << " reused, " << stats.chunk_allocs << " new chunk(s)\n";
+}
+
+struct AdvertsResponse {
+  enum class Kind { kFull, kDelta, kNotModified };
+  Kind kind = Kind::kFull;
+  std::vector<Node> nodes;
+  std::vector<int> removed_ids;
+  std::string etag;
+  // Server-side list generation as <epoch>-<n>, echoed back verbatim;
+  // empty when the server does not send one.
+  std::string generation;
+};
+
+// Without a pool, chunks are parsed on the task thread as they arrive; with
+// one, the full list is buffered and parsed in parallel once complete.
+struct NodesFetch : std::enable_shared_from_this<NodesFetch> {
+  // Chunk bytes posted to the task thread and not parsed yet. Past the limit
+  // the transfer is paused until the task thread is down to half of it.
+  static constexpr size_t kMaxQueuedBytes = 1024 * 1024;
+
+  HttpExchange exchange;
+  curl_slist *headers = nullptr;
+  bool buffered = false;
+  std::string response;
+  CURL *curl = nullptr;
+  NetworkReactor *reactor = nullptr;
+  TaskThread *worker = nullptr;
+  std::atomic<size_t> queued_bytes{0};
+  // Reactor thread only.
+  bool paused = false;
+  // Touched on the task thread only.
+  AdvertStreamState stream;
+
+  // Reactor thread.
+  void Resume() {
+    if (paused) {
+      paused = false;
+      curl_easy_pause(curl, CURLPAUSE_CONT);
+    }
+  }
+};
+
+size_t CurlWriteAdverts(char *contents, size_t size, size_t nmemb, void *userp) {
+  size_t total = size * nmemb;
+  auto *fetch = static_cast<NodesFetch *>(userp);
+  if (fetch->queued_bytes.load() >= NodesFetch::kMaxQueuedBytes) {
+    // libcurl hands the same bytes over again once resumed.
+    fetch->paused = true;
+    return CURL_WRITEFUNC_PAUSE;
+  }
+  fetch->queued_bytes += total;
+  fetch->worker->Post([fetch, chunk = std::string(contents, total)]() {
+    fetch->stream.Feed(chunk.data(), chunk.size());
+    size_t before = fetch->queued_bytes.fetch_sub(chunk.size());
+    size_t resume_at = NodesFetch::kMaxQueuedBytes / 2;
+    if (before > resume_at && before - chunk.size() <= resume_at) {
+      fetch->reactor->Post([weak = fetch->weak_from_this()]() {
+        if (auto fetch = weak.lock()) {
+          fetch->Resume();
         }
-      } else {
-        std::cerr << "Nodes fetch returned empty response\n";
-      }
-    } catch (const std::exception &e) {
-      std::cerr << "FetchNodesLoop error: " << e.what() << "\n";
-    } catch (...) {
-      std::cerr << "FetchNodesLoop error: unknown exception\n";
+      });
+    }
+  });
+  return total;
+}
+
+// A known etag makes the request conditional and a known generation asks for
+// a delta; the server may still answer with the full list.
+void StartFetchNodes(CURL *curl, const ServerEndpoint &endpoint, StringArena &arena,
+                     NetworkReactor *reactor, TaskThread *worker, bool parallel,
+                     const std::string &etag, const std::string &generation, NodesFetch *fetch) {
+  std::string url = endpoint.base_url + "/api/adverts";
+  fetch->exchange.endpoint = &endpoint;
+  if (!etag.empty()) {
+    fetch->exchange.request_headers.push_back("If-None-Match: " + etag);
+  }
+  if (!generation.empty()) {
+    char *escaped = curl_easy_escape(curl, generation.c_str(), static_cast<int>(generation.size()));
+    if (escaped) {
+      url += "?since=" + std::string(escaped);
+      curl_free(escaped);
+    }
+  }
+  // Deltas are small and may carry removal markers, so they always take the
+  // streaming parser; the parallel parser is for full lists.
+  fetch->buffered = parallel && generation.empty();
+  fetch->stream.arena = &arena;
+  fetch->curl = curl;
+  fetch->reactor = reactor;
+  fetch->worker = worker;
+  if (fetch->buffered) {
+    fetch->headers = PrepareHttpGet(curl, url, CurlWriteToString, &fetch->response,
+                                    &fetch->exchange);
+  } else {
+    fetch->headers = PrepareHttpGet(curl, url, CurlWriteAdverts, fetch, &fetch->exchange);
+  }
+}
+
+// Task thread; the reactor has already called FinishHttpGet.
+bool FinishFetchNodes(CURLcode res, StringArena &arena, WorkerPool *pool, NodesFetch *fetch,
+                      AdvertsResponse *out) {
+  const HttpExchange &exchange = fetch->exchange;
+  bool complete = false;
+  size_t skipped = 0;
+  size_t body_bytes = 0;
+  if (fetch->buffered) {
+    body_bytes = fetch->response.size();
+    if (res == CURLE_OK && exchange.status == 200 && pool) {
+      out->nodes = ParseNodesJsonParallel(fetch->response, arena, *pool);
+      complete = !out->nodes.empty();
+    }
+  } else {
+    AdvertStreamState &stream = fetch->stream;
+    complete = stream.splitter.state() == JsonArrayStreamSplitter::State::kDone;
+    skipped = stream.skipped;
+    body_bytes = stream.bytes_fed;
+    out->nodes = std::move(stream.nodes);
+    out->removed_ids = std::move(stream.removed_ids);
+  }
+  if (res != CURLE_OK) {
+    std::cerr << "Nodes fetch failed: " << curl_easy_strerror(res) << "\n";
+    return false;
+  }
+  out->etag = exchange.Header("etag");
+  out->generation = exchange.Header("x-adverts-generation");
+  if (exchange.status == 304) {
+    out->kind = AdvertsResponse::Kind::kNotModified;
+    return true;
+  }
+  LogTransferSize("Nodes fetch", exchange.wire_bytes, body_bytes);
+  if (exchange.status != 200 || !complete) {
+    std::cerr << "Nodes fetch returned unexpected response (HTTP " << exchange.status << ")\n";
+    return false;
+  }
+  out->kind = exchange.Header("x-adverts-delta") == "1" ? AdvertsResponse::Kind::kDelta
+                                                          : AdvertsResponse::Kind::kFull;
+  if (skipped > 0) {
+    std::cerr << "Nodes fetch skipped " << skipped << " malformed advert(s)\n";
+  }
+  return true;
+}
+
+// Changed nodes are replaced in place and new ones appended, so list order
+// (which breaks prefix-match ties) is stable. Names are interned again into
+// the new store's generation.
+std::vector<Node> ApplyAdvertsDelta(const std::vector<Node> &current, AdvertsResponse &delta,
+                                    StringArena &arena) {
+  std::unordered_map<int, size_t> updates;
+  for (size_t i = 0; i < delta.nodes.size(); i++) {
+    updates[delta.nodes[i].id] = i;
+  }
+  std::unordered_set<int> removed(delta.removed_ids.begin(), delta.removed_ids.end());
+  std::vector<Node> nodes;
+  nodes.reserve(current.size() + delta.nodes.size());
+  for (const Node &node : current) {
+    if (removed.count(node.id)) {
+      continue;
+    }
+    auto it = updates.find(node.id);
+    if (it != updates.end()) {
+      nodes.push_back(delta.nodes[it->second]);
+      updates.erase(it);
+      continue;
+    }
+    Node kept = node;
+    kept.name = arena.Intern(kept.name);
+    nodes.push_back(kept);
+  }
+  for (const Node &node : delta.nodes) {
+    if (updates.count(node.id)) {
+      nodes.push_back(node);
     }
-    SDL_Delay(30000);
   }
+  return nodes;
 }
 
+// Refreshes /api/adverts every kRefreshMs. The task thread owns arena_,
+// generation_ and pool_, and posts each finished store back to the reactor.
+class AdvertsRefresher {
+ public:
+  static constexpr uint64_t kRefreshMs = 30000;
+
+  AdvertsRefresher(NetworkReactor *reactor, TaskThread *worker, ServerEndpoint endpoint,
+                   AppState *state, std::mutex *mutex)
+      : reactor_(reactor),
+        worker_(worker),
+        endpoint_(std::move(endpoint)),
+        state_(state),
+        mutex_(mutex) {
+    if (const char *env = std::getenv("MESHCORETEL_PARSE_THREADS")) {
+      long threads = std::strtol(env, nullptr, 10);
+      if (threads > 1) {
+        pool_ = std::make_unique<WorkerPool>(static_cast<size_t>(std::min(threads, 64L)));
+        std::cerr << "Parsing adverts on " << pool_->size() << " threads\n";
+      }
+    }
+  }
+
+  ~AdvertsRefresher() {
+    if (fetch_) {
+      curl_slist_free_all(fetch_->headers);
+    }
+    if (curl_) {
+      curl_easy_cleanup(curl_);
+    }
+  }
+
+  // Reactor thread only.
+  void Fetch() {
+    if (curl_) {
+      curl_easy_reset(curl_);
+    } else if (!(curl_ = curl_easy_init())) {
+      std::cerr << "Nodes fetch init failed\n";
+      ScheduleNext();
+      return;
+    }
+    ConfigureSharedHandle(curl_);
+    worker_->Post([this]() { arena_.BeginGeneration(); });
+    bool have_current = current_ != nullptr;
+    fetch_ = std::make_shared<NodesFetch>();
+    StartFetchNodes(curl_, endpoint_, arena_, reactor_, worker_, pool_ != nullptr,
+                    have_current ? etag_ : std::string(),
+                    have_current ? server_generation_ : std::string(), fetch_.get());
+    reactor_->AddTransfer(curl_, [this](CURLcode res) { Finished(res); });
+  }
+
+ private:
+  // Reactor thread. Queued behind the chunks the write callback posted.
+  void Finished(CURLcode res) {
+    FinishHttpGet(curl_, &fetch_->exchange, fetch_->headers);
+    fetch_->headers = nullptr;
+    fetch_->paused = false;
+    worker_->Post([this, res, fetch = std::move(fetch_), base = current_,
+                   known_generation = server_generation_]() {
+      std::shared_ptr<const NodeStore> store;
+      AdvertsResponse response;
+      try {
+        if (FinishFetchNodes(res, arena_, pool_.get(), fetch.get(), &response)) {
+          if (response.kind == AdvertsResponse::Kind::kNotModified) {
+            std::cerr << "Nodes unchanged (generation " << known_generation << ")\n";
+          } else {
+            store = BuildStore(response, base.get());
+          }
+        }
+      } catch (const std::exception &e) {
+        std::cerr << "Nodes refresh error: " << e.what() << "\n";
+      } catch (...) {
+        std::cerr << "Nodes refresh error: unknown exception\n";
+      }
+      reactor_->Post([this, store = std::move(store), etag = std::move(response.etag),
+                      generation = std::move(response.generation)]() mutable {
+        if (store) {
+          Publish(std::move(store), std::move(etag), std::move(generation));
+        }
+        ScheduleNext();
+      });
+    });
+  }
+
+  // Task thread. Returns null when there is nothing new to show.
+  std::shared_ptr<const NodeStore> BuildStore(AdvertsResponse &response, const NodeStore *base) {
+    std::vector<Node> nodes;
+    if (response.kind == AdvertsResponse::Kind::kDelta) {
+      // Published even when it leaves no nodes: the server removed them.
+      std::cerr << "Nodes delta: " << response.nodes.size() << " changed, "
+                << response.removed_ids.size() << " removed\n";
+      // Deltas are only requested with a store on screen.
+      nodes = ApplyAdvertsDelta(base->nodes, response, arena_);
+    } else if (response.nodes.empty()) {
+      std::cerr << "Nodes fetch returned empty response\n";
+      return nullptr;
+    } else {
+      nodes = std::move(response.nodes);
+    }
+    auto store = std::make_shared<NodeStore>();
+    store->generation = ++generation_;
+    store->nodes = std::move(nodes);
+    store->strings = arena_.EndGeneration();
+    UpdateNodeIndex(*store);
+    LogStringArenaStats(arena_.stats());
+    return store;
+  }
+
+  // Reactor thread. Validators are adopted together with the store they
+  // describe, so a conditional request refers to what is on screen.
+  void Publish(std::shared_ptr<const NodeStore> store, std::string etag, std::string generation) {
+    size_t count = store->nodes.size();
+    current_ = store;
+    etag_ = std::move(etag);
+    server_generation_ = std::move(generation);
+    std::lock_guard<std::mutex> lock(*mutex_);
+    state_->node_store = std::move(store);
+    state_->last_update = FormatTimeNow();
+    std::cerr << "Nodes updated: " << count << "\n";
+  }
+
+  void ScheduleNext() {
+    reactor_->Schedule(kRefreshMs, [this]() { Fetch(); });
+  }
+
+  NetworkReactor *reactor_;
+  TaskThread *worker_;
+  ServerEndpoint endpoint_;
+  AppState *state_;
+  std::mutex *mutex_;
+  CURL *curl_ = nullptr;
+  StringArena arena_;
+  uint64_t generation_ = 0;
+  std::unique_ptr<WorkerPool> pool_;
+  std::shared_ptr<NodesFetch> fetch_;
+  std::shared_ptr<const NodeStore> current_;
+  std::string etag_;
+  std::string server_generation_;
+};
+
 }  // namespace
 
+#ifndef MESHCORETEL_NO_MAIN
 int main(int argc, char **argv) {
   (void)argc;
   (void)argv;
@@ -966,18 +4694,80 @@ int main(int argc, char **argv) {
     log.Write("Failed to load font: " + font_path);
   }
 
-  std::string base_url = "http://localhost:3000";
+  ServerEndpoint endpoint = ServerEndpoint::Parse("http://localhost:3000");
   if (const char *env = std::getenv("MESHCORETEL_SERVER_URL")) {
-    base_url = env;
+    endpoint = ServerEndpoint::Parse(env);
   }
+  log.Write("Server: " + endpoint.Describe());
 
   AppState state;
   std::mutex state_mutex;
 
-  std::thread sse_thread(RunSseThread, base_url, &state, &state_mutex);
-  std::thread nodes_thread(FetchNodesLoop, base_url, &state, &state_mutex);
+  StreamOptions stream_options;
+  stream_options.transport = ParseStreamTransport(std::getenv("MESHCORETEL_TRANSPORT"));
+  stream_options.enrich_paths = EnvFlag("MESHCORETEL_ENRICH_PATHS", true);
+  stream_options.batch_events = EnvFlag("MESHCORETEL_BATCH_EVENTS", true);
+  if (const char *env = std::getenv("MESHCORETEL_INGEST")) {
+    std::string ingest = env;
+    stream_options.direct_ingest = ingest == "direct";
+    if (ingest != "direct" && ingest != "proxy") {
+      std::cerr << "Unknown MESHCORETEL_INGEST '" << ingest << "', using proxy\n";
+    }
+  }
+  if (const char *env = std::getenv("MESHCORETEL_WS_PACKETS_URL")) {
+    stream_options.packets_ws_url = env;
+  }
+  if (const char *env = std::getenv("MESHCORETEL_WS_PROPAGATIONS_URL")) {
+    stream_options.propagations_ws_url = env;
+  }
+  if (stream_options.direct_ingest && !WebSocketsSupported()) {
+    std::cerr << "libcurl has no WebSocket support, reading events through the server\n";
+    stream_options.direct_ingest = false;
+  }
+  g_network_event_type = SDL_RegisterEvents(1);
+  if (g_network_event_type == static_cast<Uint32>(-1)) {
+    log.Write(std::string("SDL_RegisterEvents failed: ") + SDL_GetError());
+  }
+  // Direct ingest keeps a thread per WebSocket: curl_ws_recv needs a
+  // connect-only handle of its own.
+  NetworkReactor reactor;
+  TaskThread background;
+  auto adverts = std::make_unique<AdvertsRefresher>(&reactor, &background, endpoint, &state,
+                                                    &state_mutex);
+  auto tile_downloader = std::make_unique<TileDownloader>(&reactor, &background);
+  std::unique_ptr<EventStreamClient> event_stream;
+  std::vector<std::thread> event_threads;
+  StopSignal ingest_stop;
+  if (stream_options.direct_ingest) {
+    event_threads.emplace_back(RunWsIngestThread, stream_options.packets_ws_url,
+                               SseMessage::Type::kPacket, &state, &state_mutex, &ingest_stop);
+    event_threads.emplace_back(RunWsIngestThread, stream_options.propagations_ws_url,
+                               SseMessage::Type::kPropagation, &state, &state_mutex,
+                               &ingest_stop);
+  } else {
+    event_stream = std::make_unique<EventStreamClient>(&reactor, endpoint, stream_options,
+                                                       &state, &state_mutex);
+  }
+  bool reactor_running = reactor.Start();
+  if (reactor_running) {
+    reactor.Post([&adverts, &event_stream]() {
+      adverts->Fetch();
+      if (event_stream) {
+        event_stream->Connect();
+      }
+    });
+  } else {
+    log.Write("Network reactor failed to start, running offline");
+  }
+  // Downloads need the reactor to run them and an SDL event type to
+  // announce them; otherwise requested tiles would stay pending for good.
+  bool download_tiles = reactor_running && g_network_event_type != static_cast<Uint32>(-1);
+  if (!download_tiles) {
+    log.Write("Tile downloads disabled, drawing cached tiles only");
+  }
 
-  TileCache tile_cache(renderer, "native/linux/cache");
+  TileCache tile_cache(renderer, "native/linux/cache",
+                       download_tiles ? tile_downloader.get() : nullptr);
 
   bool running = true;
   int window_width = kDefaultWidth;
@@ -986,7 +4776,9 @@ int main(int argc, char **argv) {
   double center_lon = kMoscowLon;
   int zoom = kDefaultZoom;
 
+  FrameSnapshot snapshot;
   uint64_t start_ms = NowMs();
+  uint64_t last_stats_ms = start_ms;
   while (running) {
     if (g_should_quit) {
       log.Write("Shutdown requested");
@@ -1002,6 +4794,14 @@ int main(int argc, char **argv) {
           log.Write("SDL_QUIT received");
           running = false;
         }
+      } else if (event.type == g_network_event_type) {
+        auto *key = static_cast<TileKey *>(event.user.data1);
+        if (event.user.code == kTileReady) {
+          tile_cache.OnTileDownloaded(*key);
+        } else if (event.user.code == kTileDropped) {
+          tile_cache.OnTileDropped(*key);
+        }
+        delete key;
       } else if (event.type == SDL_WINDOWEVENT && event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED) {
         window_width = event.window.data1;
         window_height = event.window.data2;
@@ -1023,8 +4823,9 @@ int main(int argc, char **argv) {
         LatLonToWorldPixel(center_lat, center_lon, zoom, &center_x, &center_y);
         double top_left_x = center_x - window_width / 2.0;
         double top_left_y = center_y - window_height / 2.0;
-        for (size_t i = 0; i < state.nodes.size(); i++) {
-          const Node &node = state.nodes[i];
+        const std::vector<Node> &nodes = state.node_store->nodes;
+        for (size_t i = 0; i < nodes.size(); i++) {
+          const Node &node = nodes[i];
           if (!node.has_position) {
             continue;
           }
@@ -1078,26 +4879,55 @@ int main(int argc, char **argv) {
     SDL_Rect shade{0, 0, window_width, window_height};
     SDL_RenderFillRect(renderer, &shade);
 
-    AppState snapshot;
     {
       std::lock_guard<std::mutex> lock(state_mutex);
       uint64_t now = NowMs();
-      state.pulses.erase(std::remove_if(state.pulses.begin(), state.pulses.end(),
-                                        [now](const MovingPulse &pulse) {
-                                          return now - pulse.start_time_ms >
-                                                 static_cast<uint64_t>(pulse.duration_ms + 500.0f);
-                                        }),
-                         state.pulses.end());
-      state.paths.erase(std::remove_if(state.paths.begin(), state.paths.end(),
-                                       [now](const PathAnimation &path) {
-                                         return now - path.start_time_ms >
-                                                static_cast<uint64_t>(path.duration_ms + 1500.0f);
-                                       }),
-                        state.paths.end());
-      snapshot = state;
-    }
-
-    for (const Node &node : snapshot.nodes) {
+      state.pulses.RemoveIf([now](const MovingPulse &pulse, const MovingPulse *) {
+        return now - pulse.start_time_ms > static_cast<uint64_t>(pulse.duration_ms + 500.0f);
+      });
+      state.paths.Expire([now](const PathAnimation &path) {
+        return now - path.start_time_ms > static_cast<uint64_t>(path.duration_ms + 1500.0f);
+      });
+      if (now - last_stats_ms >= kStatsLogIntervalMs) {
+        last_stats_ms = now;
+        const EventAdmission::Counters &counters = state.admission.counters();
+        std::cerr << "Events: admitted " << counters.admitted << ", coalesced "
+                  << counters.coalesced << ", dropped " << counters.dropped
+                  << "; evicted pulses " << state.pulses.evicted() << ", paths "
+                  << state.paths.evicted() << "\n";
+        const TokenResolutionCache::Counters &cache = state.token_cache.counters();
+        uint64_t lookups = cache.hits + cache.negative_hits + cache.misses;
+        if (lookups > 0) {
+          std::cerr << "Token cache: hit rate "
+                    << (100 * (cache.hits + cache.negative_hits)) / lookups << "% (" << cache.hits
+                    << " hits, " << cache.negative_hits << " negative hits, " << cache.misses
+                    << " misses)\n";
+        }
+        std::cerr << "HTTP connections: "
+                  << g_http_connections_reused.load(std::memory_order_relaxed) << " reused, "
+                  << g_http_connections_opened.load(std::memory_order_relaxed) << " opened\n";
+        if (state.stream_gaps > 0) {
+          std::cerr << "Event stream gaps: " << state.stream_gaps << "\n";
+        }
+        for (const ConnectionHealth &health : state.connections) {
+          if (*health.name == '\0') {
+            continue;
+          }
+          std::cerr << "Connection " << health.name << ": "
+                    << (health.connected ? "up" : "down") << ", " << health.connects
+                    << " connects, " << health.disconnects << " drops";
+          if (!health.connected && health.failures > 0) {
+            std::cerr << ", " << health.failures << " failed attempts, retry after "
+                      << health.retry_delay_ms << " ms";
+          }
+          std::cerr << "\n";
+        }
+      }
+      snapshot.CopyFrom(state);
+    }
+
+    const std::vector<Node> &nodes = snapshot.node_store->nodes;
+    for (const Node &node : nodes) {
       if (!node.has_position) {
         continue;
       }
@@ -1111,7 +4941,8 @@ int main(int argc, char **argv) {
 
     if (snapshot.animations_enabled) {
       uint64_t now = NowMs();
-      for (const auto &pulse : snapshot.pulses) {
+      for (size_t p = 0; p < snapshot.pulses.size(); p++) {
+        const MovingPulse &pulse = snapshot.pulses[p];
         float progress = static_cast<float>(now - pulse.start_time_ms) / pulse.duration_ms;
         if (progress < 0.0f || progress > 1.0f) {
           continue;
@@ -1120,14 +4951,17 @@ int main(int argc, char **argv) {
         float y = pulse.start.y + (pulse.end.y - pulse.start.y) * progress;
         int sx = static_cast<int>(x - top_left_x);
         int sy = static_cast<int>(y - top_left_y);
-        DrawFilledCircle(renderer, sx, sy, 4, SDL_Color{0, 255, 234, 200});
+        int radius = static_cast<int>(3.0f + pulse.intensity);
+        DrawFilledCircle(renderer, sx, sy, radius, SDL_Color{0, 255, 234, 200});
       }
 
-      for (const auto &path : snapshot.paths) {
+      for (size_t p = 0; p < snapshot.paths.size(); p++) {
+        const PathAnimation &path = snapshot.paths[p];
         float progress = static_cast<float>(now - path.start_time_ms) / path.duration_ms;
         if (progress < 0.0f || progress > 2.5f) {
           continue;
         }
+        const SDL_FPoint *points = snapshot.path_points.data() + path.first_point;
         float alpha_scale = progress <= 1.0f ? 1.0f : std::max(0.0f, 1.0f - (progress - 1.0f));
         SDL_Color core_color = path.color;
         core_color.a = static_cast<Uint8>(220 * alpha_scale);
@@ -1135,14 +4969,15 @@ int main(int argc, char **argv) {
         glow_color.a = static_cast<Uint8>(90 * alpha_scale);
         SDL_Color outer_color = path.color;
         outer_color.a = static_cast<Uint8>(40 * alpha_scale);
-        for (size_t i = 1; i < path.points.size(); i++) {
-          int x1 = static_cast<int>(path.points[i - 1].x - top_left_x);
-          int y1 = static_cast<int>(path.points[i - 1].y - top_left_y);
-          int x2 = static_cast<int>(path.points[i].x - top_left_x);
-          int y2 = static_cast<int>(path.points[i].y - top_left_y);
-          DrawThickLine(renderer, x1, y1, x2, y2, path.width + 4.0f, outer_color, SDL_BLENDMODE_ADD);
-          DrawThickLine(renderer, x1, y1, x2, y2, path.width + 2.0f, glow_color, SDL_BLENDMODE_ADD);
-          DrawThickLine(renderer, x1, y1, x2, y2, path.width, core_color, SDL_BLENDMODE_BLEND);
+        float width = path.width + (path.intensity - 1.0f);
+        for (size_t i = 1; i < path.point_count; i++) {
+          int x1 = static_cast<int>(points[i - 1].x - top_left_x);
+          int y1 = static_cast<int>(points[i - 1].y - top_left_y);
+          int x2 = static_cast<int>(points[i].x - top_left_x);
+          int y2 = static_cast<int>(points[i].y - top_left_y);
+          DrawThickLine(renderer, x1, y1, x2, y2, width + 4.0f, outer_color, SDL_BLENDMODE_ADD);
+          DrawThickLine(renderer, x1, y1, x2, y2, width + 2.0f, glow_color, SDL_BLENDMODE_ADD);
+          DrawThickLine(renderer, x1, y1, x2, y2, width, core_color, SDL_BLENDMODE_BLEND);
         }
       }
     }
@@ -1154,15 +4989,15 @@ int main(int argc, char **argv) {
       SDL_Rect overlay{20, 20, 260, 80};
       SDL_RenderFillRect(renderer, &overlay);
       DrawText(renderer, font, "MeshCoreTel Network", white, 30, 28);
-      DrawText(renderer, font, "Nodes: " + std::to_string(snapshot.nodes.size()), muted, 30, 52);
+      DrawText(renderer, font, "Nodes: " + std::to_string(nodes.size()), muted, 30, 52);
 
       SDL_Rect node_box{20, window_height - 140, 320, 110};
       SDL_RenderFillRect(renderer, &node_box);
       DrawText(renderer, font, "Node Information", white, 30, window_height - 130);
       if (snapshot.selected_node_index >= 0 &&
-          snapshot.selected_node_index < static_cast<int>(snapshot.nodes.size())) {
-        const Node &node = snapshot.nodes[snapshot.selected_node_index];
-        DrawText(renderer, font, node.name.empty() ? "Unnamed" : node.name, muted,
+          snapshot.selected_node_index < static_cast<int>(nodes.size())) {
+        const Node &node = nodes[snapshot.selected_node_index];
+        DrawText(renderer, font, node.name.empty() ? "Unnamed" : std::string(node.name), muted,
                  30, window_height - 105);
         std::ostringstream detail;
         detail << "ID: " << node.id << "  Lat: " << node.lat << "  Lon: " << node.lon;
@@ -1198,23 +5033,30 @@ int main(int argc, char **argv) {
   }
 
   log.Write("Client shutting down");
+  // Cancels whatever is in flight, so the network components can go before
+  // libcurl is cleaned up.
+  reactor.Stop();
+  background.Stop();
+  event_stream.reset();
+  adverts.reset();
+  tile_downloader.reset();
+  ingest_stop.Set();
+  for (std::thread &event_thread : event_threads) {
+    event_thread.join();
+  }
   tile_cache.Clear();
   if (font) {
     TTF_CloseFont(font);
   }
   SDL_DestroyRenderer(renderer);
   SDL_DestroyWindow(window);
+  t_curl.Release();
+  CurlShare::Cleanup();
   curl_global_cleanup();
   TTF_Quit();
   IMG_Quit();
   SDL_Quit();
 
-  if (sse_thread.joinable()) {
-    sse_thread.detach();
-  }
-  if (nodes_thread.joinable()) {
-    nodes_thread.detach();
-  }
-
   return 0;
 }
+#endif  // MESHCORETEL_NO_MAIN
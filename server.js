@@ -2,13 +2,35 @@ const express = require('express');
 const WebSocket = require('ws');
 const http = require('http');
 const path = require('path');
+const fs = require('fs');
 const cors = require('cors');
 const helmet = require('helmet');
 const axios = require('axios');
+const zlib = require('zlib');
+const crypto = require('crypto');
+const { promisify } = require('util');
 
 const app = express();
 const server = http.createServer(app);
 
+// Keep idle connections open past the native client's 30 s adverts refresh
+// so it can reuse its pooled connection instead of reconnecting each time.
+server.keepAliveTimeout = 65000;
+server.headersTimeout = 66000;
+
+// A native client on the same host can talk to the server over a Unix domain
+// socket instead of TCP loopback: MESHCORETEL_SERVER_URL=unix:///path.sock,
+// the same variable the client reads, adds a listener on that path. The TCP
+// port keeps serving the web UI.
+const UNIX_URL_PREFIX = 'unix://';
+const serverUrl = process.env.MESHCORETEL_SERVER_URL || '';
+const socketPath = serverUrl.startsWith(UNIX_URL_PREFIX) ? serverUrl.slice(UNIX_URL_PREFIX.length) : null;
+const socketServer = socketPath ? http.createServer(app) : null;
+if (socketServer) {
+  socketServer.keepAliveTimeout = server.keepAliveTimeout;
+  socketServer.headersTimeout = server.headersTimeout;
+}
+
 // Security middleware
 app.use(helmet({
   contentSecurityPolicy: {
@@ -30,46 +52,315 @@ app.use(cors());
 // Serve static files
 app.use(express.static(path.join(__dirname, 'public')));
 
-// API proxy endpoints
-app.get('/api/adverts', async (req, res) => {
-  const startedAt = Date.now();
-  try {
-    const { limit: reqLimit, offset: reqOffset } = req.query;
+// Response compression
+const gzipAsync = promisify(zlib.gzip);
+const deflateAsync = promisify(zlib.deflate);
+const MIN_COMPRESS_BYTES = 1024;
 
-    // If no limit is specified, fetch all adverts by paginating through all pages
-    if (reqLimit === undefined) {
-      let allData = [];
-      let offset = 0;
-      const limit = 100; // Use 100 as the page size for fetching all data
+// Picks gzip or deflate from the Accept-Encoding header (q=0 means refused)
+const negotiateEncoding = (req) => {
+  const offered = {};
+  (req.headers['accept-encoding'] || '').split(',').forEach(part => {
+    const [name, ...params] = part.trim().split(';');
+    const q = params.map(param => param.trim()).find(param => param.startsWith('q='));
+    offered[name.trim().toLowerCase()] = q ? parseFloat(q.slice(2)) : 1;
+  });
+  if (offered.gzip > 0) {
+    return 'gzip';
+  }
+  if (offered.deflate > 0) {
+    return 'deflate';
+  }
+  return null;
+};
 
-      while(true) {
-        const response = await axios.get(`https://www.meshcoretel.ru/api/adverts?limit=${limit}&offset=${offset}`);
-        const data = response.data;
+// Sends data as JSON, compressed off the event loop when the client accepts
+// it. Returns the raw and sent sizes for logging.
+const sendJson = async (req, res, data) => {
+  const body = Buffer.from(JSON.stringify(data));
+  const encoding = body.length >= MIN_COMPRESS_BYTES ? negotiateEncoding(req) : null;
+  res.set('Vary', 'Accept-Encoding');
+  res.type('application/json');
+  if (!encoding) {
+    res.send(body);
+    return { raw: body.length, sent: body.length };
+  }
+  const compressed = await (encoding === 'gzip' ? gzipAsync(body) : deflateAsync(body));
+  res.set('Content-Encoding', encoding);
+  res.send(compressed);
+  return { raw: body.length, sent: compressed.length };
+};
 
-        if (!Array.isArray(data) || data.length === 0) {
-          break;
-        }
+// Messages a slow event-stream client may have waiting before the oldest
+// ones are dropped
+const STREAM_QUEUE_LIMIT = parseInt(process.env.STREAM_QUEUE_LIMIT, 10) || 256;
 
-        allData = allData.concat(data);
+// Opens a long-lived response. When the client accepts gzip or deflate it
+// gets its own compression context, flushed after every message so events
+// leave immediately while still sharing the window with earlier ones.
+// Writes go straight through until the socket (or compressor) pushes back;
+// after that messages wait in a queue of at most STREAM_QUEUE_LIMIT entries,
+// dropping the oldest, and drain again on 'drain'. stats() reports the
+// backlog, the drops and how far behind the client is.
+const openEventStream = (req, res, headers) => {
+  const encoding = negotiateEncoding(req);
+  let sink = res;
+  let flush = () => {};
+  let finish = () => {};
+  if (encoding) {
+    res.writeHead(200, { ...headers, 'Content-Encoding': encoding, 'Vary': 'Accept-Encoding' });
+    const compressor = encoding === 'gzip' ? zlib.createGzip() : zlib.createDeflate();
+    compressor.on('error', error => console.error('Stream compression error:', error.message));
+    compressor.pipe(res);
+    sink = compressor;
+    flush = () => compressor.flush(zlib.constants.Z_SYNC_FLUSH);
+    finish = () => compressor.end();
+  } else {
+    res.writeHead(200, headers);
+  }
+
+  const queue = []; // { chunk, queuedAt }
+  let blocked = false;
+  let dropped = 0;
+  let maxLagMs = 0;
+
+  const send = (chunk, queuedAt) => {
+    maxLagMs = Math.max(maxLagMs, Date.now() - queuedAt);
+    const accepted = sink.write(chunk);
+    flush();
+    return accepted;
+  };
+
+  sink.on('drain', () => {
+    blocked = false;
+    while (queue.length > 0 && !blocked) {
+      const { chunk, queuedAt } = queue.shift();
+      blocked = !send(chunk, queuedAt);
+    }
+  });
 
-        // If we got less than the limit, it means we're at the last page
-        if (data.length < limit) {
-          break;
+  return {
+    write: chunk => {
+      const now = Date.now();
+      if (!blocked) {
+        blocked = !send(chunk, now);
+        return;
+      }
+      if (queue.length >= STREAM_QUEUE_LIMIT) {
+        queue.shift();
+        if (dropped++ === 0) {
+          console.warn(`Event stream client ${req.socket.remoteAddress} is falling behind, dropping oldest messages`);
         }
+      }
+      queue.push({ chunk, queuedAt: now });
+    },
+    end: () => {
+      queue.length = 0;
+      finish();
+    },
+    stats: () => ({
+      queued: queue.length,
+      dropped,
+      lagMs: queue.length > 0 ? Date.now() - queue[0].queuedAt : 0,
+      maxLagMs
+    })
+  };
+};
+
+// Full adverts list, refreshed in the background and shared by every
+// client. The generation advances whenever the list changes, and the change
+// sets of recent generations are kept so clients can ask for
+// ?since=<epoch>-<generation> and get only changed or removed adverts; the
+// epoch tells a restarted server's generations apart. The response body is
+// serialized and compressed once per generation.
+const ADVERTS_HISTORY = 32;
+const ADVERTS_PAGE_SIZE = 100;
+const ADVERTS_PAGE_CONCURRENCY = parseInt(process.env.ADVERTS_PAGE_CONCURRENCY, 10) || 4;
+const ADVERTS_REFRESH_MS = parseInt(process.env.ADVERTS_REFRESH_MS, 10) || 30000;
+const ADVERTS_EPOCH = Date.now().toString(36);
+const advertsCache = {
+  generation: 0,
+  etag: null,
+  count: 0,
+  items: new Map(), // advert key -> { item, json }
+  history: [], // { generation, changed: Set(key), removed: Map(key -> marker) }
+  bodies: null // { identity, gzip, deflate } Buffers of the full list
+};
+let advertsRefresh = null;
+
+const advertKey = (item) => String(item.id ?? item.public_key_hex);
 
-        offset += limit;
+// Pages through upstream ADVERTS_PAGE_CONCURRENCY pages at a time until a
+// short or empty page marks the end
+const fetchAllAdverts = async () => {
+  const pages = [];
+  for (let first = 0; ; first += ADVERTS_PAGE_CONCURRENCY) {
+    const wave = await Promise.all(Array.from({ length: ADVERTS_PAGE_CONCURRENCY }, (_, i) => {
+      const offset = (first + i) * ADVERTS_PAGE_SIZE;
+      return axios.get(`https://www.meshcoretel.ru/api/adverts?limit=${ADVERTS_PAGE_SIZE}&offset=${offset}`)
+        .then(response => (Array.isArray(response.data) ? response.data : []));
+    }));
+    for (const page of wave) {
+      pages.push(page);
+      if (page.length < ADVERTS_PAGE_SIZE) {
+        return pages.flat();
       }
+    }
+  }
+};
+
+// Serializes each advert once; the per-item JSON feeds the ETag, the change
+// detection and the shared response body
+const serializeAdverts = (list) => {
+  const items = new Map();
+  const jsons = [];
+  const hash = crypto.createHash('sha1');
+  list.forEach(item => {
+    const json = JSON.stringify(item);
+    hash.update(json).update('\n');
+    items.set(advertKey(item), { item, json });
+    jsons.push(json);
+  });
+  return {
+    items,
+    count: list.length,
+    etag: `W/"${hash.digest('base64url')}"`,
+    body: Buffer.from(`[${jsons.join(',')}]`)
+  };
+};
+
+// Makes a serialized list current, recording what changed since the last one
+const commitAdverts = (snapshot, bodies) => {
+  const changed = new Set();
+  snapshot.items.forEach((entry, key) => {
+    const previous = advertsCache.items.get(key);
+    if (!previous || previous.json !== entry.json) {
+      changed.add(key);
+    }
+  });
+  const removed = new Map();
+  advertsCache.items.forEach((entry, key) => {
+    if (!snapshot.items.has(key)) {
+      removed.set(key, { id: entry.item.id, public_key_hex: entry.item.public_key_hex, removed: true });
+    }
+  });
+  advertsCache.generation++;
+  advertsCache.etag = snapshot.etag;
+  advertsCache.count = snapshot.count;
+  advertsCache.items = snapshot.items;
+  advertsCache.bodies = bodies;
+  advertsCache.history.push({ generation: advertsCache.generation, changed, removed });
+  if (advertsCache.history.length > ADVERTS_HISTORY) {
+    advertsCache.history.shift();
+  }
+};
+
+// Starts a background refresh unless one is already running; requests that
+// arrive before the first refresh completes wait on the returned promise
+const refreshAdverts = () => {
+  if (advertsRefresh) {
+    return advertsRefresh;
+  }
+  const startedAt = Date.now();
+  advertsRefresh = (async () => {
+    try {
+      const snapshot = serializeAdverts(await fetchAllAdverts());
+      if (snapshot.etag === advertsCache.etag) {
+        console.log(`Adverts unchanged (${snapshot.count} items) in ${Date.now() - startedAt}ms`);
+        return;
+      }
+      const [gzip, deflate] = await Promise.all([gzipAsync(snapshot.body), deflateAsync(snapshot.body)]);
+      commitAdverts(snapshot, { identity: snapshot.body, gzip, deflate });
+      console.log(`Adverts generation ${advertsCache.generation}: ${snapshot.count} items, ` +
+        `${snapshot.body.length} bytes (gzip ${gzip.length}) in ${Date.now() - startedAt}ms`);
+    } catch (error) {
+      console.error('Error refreshing adverts:', error.message);
+    } finally {
+      advertsRefresh = null;
+    }
+  })();
+  return advertsRefresh;
+};
+
+const advertsGenerationId = () => `${ADVERTS_EPOCH}-${advertsCache.generation}`;
+
+// Adverts changed or removed after generation id `sinceId`, or null when that
+// generation is from another epoch or too old (or unknown) to build a delta from
+const advertsDeltaSince = (sinceId) => {
+  const [epoch, generationText] = String(sinceId).split('-');
+  const since = Number(generationText);
+  if (epoch !== ADVERTS_EPOCH || !Number.isInteger(since) || since < 0 || since > advertsCache.generation) {
+    return null;
+  }
+  const oldest = advertsCache.history.length > 0 ? advertsCache.history[0].generation : advertsCache.generation + 1;
+  if (since !== advertsCache.generation && since + 1 < oldest) {
+    return null;
+  }
+  const touched = new Map();
+  advertsCache.history
+    .filter(entry => entry.generation > since)
+    .forEach(entry => {
+      entry.changed.forEach(key => touched.set(key, null));
+      entry.removed.forEach((marker, key) => touched.set(key, marker));
+    });
+  const delta = [];
+  touched.forEach((marker, key) => {
+    const current = advertsCache.items.get(key);
+    delta.push(current ? current.item : marker);
+  });
+  return delta;
+};
+
+const ifNoneMatch = (req, etag) =>
+  (req.headers['if-none-match'] || '').split(',').some(tag => tag.trim() === etag);
+
+// API proxy endpoints
+app.get('/api/adverts', async (req, res) => {
+  const startedAt = Date.now();
+  try {
+    const { limit: reqLimit, offset: reqOffset } = req.query;
 
-      console.log(`GET /api/adverts -> ${allData.length} items in ${Date.now() - startedAt}ms`);
-      res.json(allData);
+    // Without a limit, answer from the shared cache
+    if (reqLimit === undefined) {
+      if (!advertsCache.bodies) {
+        await refreshAdverts();
+      }
+      if (!advertsCache.bodies) {
+        res.status(500).json({ error: 'Failed to fetch adverts' });
+        return;
+      }
+      res.set({
+        'ETag': advertsCache.etag,
+        'X-Adverts-Generation': advertsGenerationId(),
+        'Vary': 'Accept-Encoding'
+      });
+      if (ifNoneMatch(req, advertsCache.etag)) {
+        res.status(304).end();
+        console.log(`GET /api/adverts -> 304 (generation ${advertsGenerationId()}) in ${Date.now() - startedAt}ms`);
+        return;
+      }
+      const delta = req.query.since !== undefined ? advertsDeltaSince(req.query.since) : null;
+      res.set('X-Adverts-Delta', delta ? '1' : '0');
+      if (delta) {
+        const size = await sendJson(req, res, delta);
+        console.log(`GET /api/adverts -> ${delta.length} items (delta since ${req.query.since}), ${size.sent}/${size.raw} bytes in ${Date.now() - startedAt}ms`);
+        return;
+      }
+      const encoding = negotiateEncoding(req);
+      const body = advertsCache.bodies[encoding || 'identity'];
+      if (encoding) {
+        res.set('Content-Encoding', encoding);
+      }
+      res.type('application/json').send(body);
+      console.log(`GET /api/adverts -> ${advertsCache.count} items (cached), ${body.length} bytes in ${Date.now() - startedAt}ms`);
     } else {
       // Use the requested limit and offset
       const limit = parseInt(reqLimit) || 100;
       const offset = parseInt(reqOffset) || 0;
       const response = await axios.get(`https://www.meshcoretel.ru/api/adverts?limit=${limit}&offset=${offset}`);
       const count = Array.isArray(response.data) ? response.data.length : 0;
-      console.log(`GET /api/adverts?limit=${limit}&offset=${offset} -> ${count} items in ${Date.now() - startedAt}ms`);
-      res.json(response.data);
+      const size = await sendJson(req, res, response.data);
+      console.log(`GET /api/adverts?limit=${limit}&offset=${offset} -> ${count} items, ${size.sent}/${size.raw} bytes in ${Date.now() - startedAt}ms`);
     }
   } catch (error) {
     console.error('Error fetching adverts:', error.message);
@@ -143,112 +434,552 @@ app.get('/events', (req, res) => {
   });
 });
 
-// Create WebSocket connections to the original service
-let packetsWs, propagationsWs;
+// Each upstream WebSocket is kept open by its own supervisor, so a drop on
+// one stream never touches the other. After a drop the first retry comes
+// quickly; repeated failures back off exponentially with jitter up to
+// UPSTREAM_RETRY_MAX_MS. A connection that stays up for UPSTREAM_STABLE_MS
+// starts the sequence over.
+const UPSTREAM_RETRY_FIRST_MS = 250;
+const UPSTREAM_RETRY_BASE_MS = 1000;
+const UPSTREAM_RETRY_MAX_MS = parseInt(process.env.UPSTREAM_RETRY_MAX_MS, 10) || 60000;
+const UPSTREAM_STABLE_MS = 30000;
 
-const setupWebSocketProxy = () => {
-  // Close existing connections if they exist
-  if (packetsWs) {
-    packetsWs.close();
-  }
-  if (propagationsWs) {
-    propagationsWs.close();
-  }
+// Half the delay is fixed and half random, so servers restarted together
+// don't reconnect in lockstep.
+const upstreamRetryDelay = (failures) => {
+  const delay = failures === 0
+    ? UPSTREAM_RETRY_FIRST_MS
+    : Math.min(UPSTREAM_RETRY_MAX_MS, UPSTREAM_RETRY_BASE_MS * 2 ** Math.min(failures - 1, 16));
+  return Math.round(delay / 2 + Math.random() * delay / 2);
+};
 
-  // WebSocket for packets
-  packetsWs = new WebSocket('wss://www.meshcoretel.ru/ws/packets');
+const createUpstreamSupervisor = (name, url, messageType) => {
+  const upstream = {
+    name,
+    url,
+    state: 'idle', // idle, connecting, open or waiting
+    ws: null,
+    retryTimer: null,
+    failures: 0,
+    connects: 0,
+    disconnects: 0,
+    messages: 0,
+    openedAt: null,
+    lastMessageAt: null,
+    nextRetryAt: null,
+    lastError: null
+  };
 
-  packetsWs.on('open', () => {
-    console.log('Connected to packets WebSocket');
-    connectionStatus = 'Connected to packets WS';
-    // Broadcast status update to all clients
+  const setStatus = (status) => {
+    connectionStatus = status;
     broadcastToSSE({ type: 'statusUpdate', connectionStatus: connectionStatus });
-  });
+  };
 
-  packetsWs.on('message', (data) => {
-    try {
-      // Forward message to clients connected to our server
-      broadcastToSSE({ type: 'packet', data: data.toString() });
-    } catch (error) {
-      console.error('Error processing packet message:', error);
+  const scheduleRetry = () => {
+    if (upstream.retryTimer) {
+      return;
     }
-  });
+    const delay = upstreamRetryDelay(upstream.failures);
+    upstream.failures++;
+    upstream.state = 'waiting';
+    upstream.nextRetryAt = Date.now() + delay;
+    console.log(`${name} WebSocket reconnecting in ${delay}ms (attempt ${upstream.failures})`);
+    upstream.retryTimer = setTimeout(connect, delay);
+  };
 
-  packetsWs.on('close', () => {
-    console.log('Packets WebSocket closed. Reconnecting...');
-    connectionStatus = 'Packets WS disconnected';
-    // Broadcast status update to all clients
-    broadcastToSSE({ type: 'statusUpdate', connectionStatus: connectionStatus });
-    setTimeout(setupWebSocketProxy, 5000);
-  });
+  const connect = () => {
+    upstream.retryTimer = null;
+    upstream.nextRetryAt = null;
+    upstream.state = 'connecting';
+    const ws = new WebSocket(url);
+    upstream.ws = ws;
 
-  packetsWs.on('error', (error) => {
-    console.error('Packets WebSocket error:', error);
-    connectionStatus = 'Packets WS error';
-    // Broadcast status update to all clients
-    broadcastToSSE({ type: 'statusUpdate', connectionStatus: connectionStatus });
-  });
+    ws.on('open', () => {
+      console.log(`Connected to ${name.toLowerCase()} WebSocket`);
+      upstream.state = 'open';
+      upstream.connects++;
+      upstream.openedAt = Date.now();
+      upstream.lastError = null;
+      setStatus(`Connected to ${name.toLowerCase()} WS`);
+    });
 
-  // WebSocket for propagations
-  propagationsWs = new WebSocket('wss://www.meshcoretel.ru/ws/propagations');
+    ws.on('message', (data) => {
+      upstream.messages++;
+      upstream.lastMessageAt = Date.now();
+      try {
+        // Forward message to clients connected to our server
+        broadcastToSSE({ type: messageType, data: data.toString() });
+      } catch (error) {
+        console.error(`Error processing ${messageType} message:`, error);
+      }
+    });
 
-  propagationsWs.on('open', () => {
-    console.log('Connected to propagations WebSocket');
-    connectionStatus = 'Connected to propagations WS';
-    // Broadcast status update to all clients
-    broadcastToSSE({ type: 'statusUpdate', connectionStatus: connectionStatus });
-  });
+    ws.on('error', (error) => {
+      console.error(`${name} WebSocket error:`, error.message);
+      upstream.lastError = error.message;
+      setStatus(`${name} WS error`);
+    });
 
-  propagationsWs.on('message', (data) => {
-    try {
-      // Forward message to clients connected to our server
-      broadcastToSSE({ type: 'propagation', data: data.toString() });
-    } catch (error) {
-      console.error('Error processing propagation message:', error);
+    // ws emits 'close' after failed connection attempts too, so this is the
+    // only place that schedules a retry.
+    ws.on('close', () => {
+      if (upstream.ws !== ws) {
+        return;
+      }
+      upstream.ws = null;
+      if (upstream.openedAt !== null) {
+        upstream.disconnects++;
+        if (Date.now() - upstream.openedAt >= UPSTREAM_STABLE_MS) {
+          upstream.failures = 0;
+        }
+        upstream.openedAt = null;
+        console.log(`${name} WebSocket closed`);
+        setStatus(`${name} WS disconnected`);
+      }
+      scheduleRetry();
+    });
+  };
+
+  upstream.start = () => {
+    if (upstream.state === 'idle') {
+      connect();
     }
-  });
+  };
 
-  propagationsWs.on('close', () => {
-    console.log('Propagations WebSocket closed. Reconnecting...');
-    connectionStatus = 'Propagations WS disconnected';
-    // Broadcast status update to all clients
-    broadcastToSSE({ type: 'statusUpdate', connectionStatus: connectionStatus });
-    setTimeout(setupWebSocketProxy, 5000);
-  });
+  upstream.health = () => {
+    const now = Date.now();
+    return {
+      name,
+      url,
+      state: upstream.state,
+      failures: upstream.failures,
+      connects: upstream.connects,
+      disconnects: upstream.disconnects,
+      messages: upstream.messages,
+      uptimeMs: upstream.openedAt === null ? null : now - upstream.openedAt,
+      lastMessageAgoMs: upstream.lastMessageAt === null ? null : now - upstream.lastMessageAt,
+      nextRetryMs: upstream.nextRetryAt === null ? null : Math.max(0, upstream.nextRetryAt - now),
+      lastError: upstream.lastError
+    };
+  };
 
-  propagationsWs.on('error', (error) => {
-    console.error('Propagations WebSocket error:', error);
-    connectionStatus = 'Propagations WS error';
-    // Broadcast status update to all clients
-    broadcastToSSE({ type: 'statusUpdate', connectionStatus: connectionStatus });
-  });
+  return upstream;
 };
 
+// Create WebSocket connections to the original service
+const upstreams = [
+  createUpstreamSupervisor('Packets', 'wss://www.meshcoretel.ru/ws/packets', 'packet'),
+  createUpstreamSupervisor('Propagations', 'wss://www.meshcoretel.ru/ws/propagations', 'propagation')
+];
+
+// Connection state, reconnect attempts and traffic of each upstream WebSocket
+app.get('/api/upstream-health', (req, res) => {
+  res.json(upstreams.map(upstream => upstream.health()));
+});
+
 // Global connection status
 let connectionStatus = 'Initializing...';
 
 // SSE clients storage
 const sseClients = [];
 
-const broadcastToSSE = (data) => {
-  sseClients.forEach(client => {
+// Binary stream clients storage (see /stream)
+const streamClients = [];
+
+// Minimal MessagePack encoder for JSON-shaped values: nil, booleans,
+// integers, float64, UTF-8 strings, arrays and maps.
+const encodeMsgpack = (value) => {
+  let buffer = Buffer.allocUnsafe(256);
+  let offset = 0;
+
+  const reserve = (size) => {
+    if (offset + size <= buffer.length) {
+      return;
+    }
+    const grown = Buffer.allocUnsafe(Math.max(buffer.length * 2, offset + size));
+    buffer.copy(grown, 0, 0, offset);
+    buffer = grown;
+  };
+
+  const writeHeader = (small, smallMax, codes, length) => {
+    if (length <= smallMax) {
+      reserve(1);
+      buffer[offset++] = small | length;
+    } else if (codes[0] !== undefined && length <= 0xff) {
+      reserve(2);
+      buffer[offset++] = codes[0];
+      buffer[offset++] = length;
+    } else if (length <= 0xffff) {
+      reserve(3);
+      buffer[offset++] = codes[1];
+      offset = buffer.writeUInt16BE(length, offset);
+    } else {
+      reserve(5);
+      buffer[offset++] = codes[2];
+      offset = buffer.writeUInt32BE(length, offset);
+    }
+  };
+
+  const write = (item) => {
+    if (item === null || item === undefined) {
+      reserve(1);
+      buffer[offset++] = 0xc0;
+    } else if (typeof item === 'boolean') {
+      reserve(1);
+      buffer[offset++] = item ? 0xc3 : 0xc2;
+    } else if (typeof item === 'number') {
+      reserve(9);
+      if (Number.isInteger(item) && item >= 0 && item <= 0x7f) {
+        buffer[offset++] = item;
+      } else if (Number.isInteger(item) && item < 0 && item >= -32) {
+        buffer[offset++] = item & 0xff;
+      } else if (Number.isInteger(item) && item >= 0 && item <= 0xffffffff) {
+        buffer[offset++] = 0xce;
+        offset = buffer.writeUInt32BE(item, offset);
+      } else if (Number.isInteger(item) && item < 0 && item >= -0x80000000) {
+        buffer[offset++] = 0xd2;
+        offset = buffer.writeInt32BE(item, offset);
+      } else {
+        buffer[offset++] = 0xcb;
+        offset = buffer.writeDoubleBE(item, offset);
+      }
+    } else if (typeof item === 'string') {
+      const length = Buffer.byteLength(item);
+      writeHeader(0xa0, 31, [0xd9, 0xda, 0xdb], length);
+      reserve(length);
+      offset += buffer.write(item, offset);
+    } else if (Array.isArray(item)) {
+      writeHeader(0x90, 15, [undefined, 0xdc, 0xdd], item.length);
+      item.forEach(write);
+    } else if (typeof item === 'object') {
+      const keys = Object.keys(item).filter(key => item[key] !== undefined);
+      writeHeader(0x80, 15, [undefined, 0xde, 0xdf], keys.length);
+      keys.forEach(key => {
+        write(key);
+        write(item[key]);
+      });
+    } else {
+      reserve(1);
+      buffer[offset++] = 0xc0;
+    }
+  };
+
+  write(value);
+  return buffer.subarray(0, offset);
+};
+
+// A /stream frame: 4-byte big-endian length followed by the MessagePack body.
+const frameStreamBody = (body) => {
+  const frame = Buffer.allocUnsafe(4 + body.length);
+  frame.writeUInt32BE(body.length, 0);
+  body.copy(frame, 4);
+  return frame;
+};
+
+const encodeStreamFrame = (data) => frameStreamBody(encodeMsgpack(data));
+
+// Upstream messages are JSON text; binary clients get them parsed so they
+// are not decoded twice on the other end.
+const toStreamMessage = (data) => {
+  if (typeof data.data !== 'string') {
+    return data;
+  }
+  try {
+    return { ...data, data: JSON.parse(data.data) };
+  } catch (error) {
+    return data;
+  }
+};
+
+// Path enrichment for clients that connect with ?enrich=1. Hop tokens of
+// propagation events are resolved here once, against the adverts cache and
+// with the native client's rules: a number is a node_hash, a string is the
+// hex prefix of the first advert (in list order) whose public key or
+// node_hash matches it. Resolutions are memoized until the next adverts
+// generation.
+const hopResolver = {
+  generation: -1,
+  nodes: [], // { id, key, hash, lat, lon } in list order
+  byHash: new Map(),
+  tokens: new Map() // upper-cased token -> hop or null
+};
+
+const advertPosition = (item) => {
+  const lat = item.lat;
+  const lon = typeof item.lon === 'number' ? item.lon : item.lng;
+  if (typeof lat !== 'number' || typeof lon !== 'number' || (lat === 0 && lon === 0) ||
+      Math.abs(lat) > 90 || Math.abs(lon) > 180) {
+    return null;
+  }
+  return { lat, lon };
+};
+
+const syncHopResolver = () => {
+  if (hopResolver.generation === advertsCache.generation) {
+    return;
+  }
+  hopResolver.generation = advertsCache.generation;
+  hopResolver.nodes = [];
+  hopResolver.byHash = new Map();
+  hopResolver.tokens = new Map();
+  advertsCache.items.forEach(({ item }) => {
+    const hash = Number.isInteger(item.node_hash) && item.node_hash !== 0 ? item.node_hash : null;
+    const position = advertPosition(item);
+    const node = {
+      id: item.id ?? null,
+      key: typeof item.public_key_hex === 'string' ? item.public_key_hex.toUpperCase() : '',
+      hash: hash === null ? '' : (hash >>> 0).toString(16).toUpperCase(),
+      lat: position ? position.lat : null,
+      lon: position ? position.lon : null
+    };
+    hopResolver.nodes.push(node);
+    if (hash !== null) {
+      hopResolver.byHash.set(hash | 0, node);
+    }
+  });
+};
+
+const resolveHop = (hop) => {
+  if (typeof hop === 'number') {
+    return hopResolver.byHash.get(hop | 0) || null;
+  }
+  if (typeof hop !== 'string' || !/^[0-9A-Fa-f]{1,64}$/.test(hop)) {
+    return null;
+  }
+  const token = hop.toUpperCase();
+  if (!hopResolver.tokens.has(token)) {
+    const node = hopResolver.nodes.find(candidate =>
+      candidate.key.startsWith(token) || (candidate.hash !== '' && candidate.hash.startsWith(token)));
+    hopResolver.tokens.set(token, node || null);
+  }
+  return hopResolver.tokens.get(token);
+};
+
+// Adds path.hop_ids, path.hop_lats and path.hop_lons next to path.nodes, one
+// entry per hop and null where the hop has no positioned node, plus the
+// count of such hops in path.unresolved_hops.
+const enrichPath = (message) => {
+  const path = message && message.path;
+  if (!path || !Array.isArray(path.nodes)) {
+    return message;
+  }
+  syncHopResolver();
+  const hops = path.nodes.map(resolveHop);
+  return {
+    ...message,
+    path: {
+      ...path,
+      hop_ids: hops.map(hop => (hop ? hop.id : null)),
+      hop_lats: hops.map(hop => (hop ? hop.lat : null)),
+      hop_lons: hops.map(hop => (hop ? hop.lon : null)),
+      unresolved_hops: hops.filter(hop => !hop || hop.lat === null).length
+    }
+  };
+};
+
+const removeClient = (clients, client) => {
+  const index = clients.indexOf(client);
+  if (index > -1) {
+    clients.splice(index, 1);
+  }
+};
+
+// Serializes a message lazily, once per variant: 'sse' gives the JSON text of
+// the envelope and 'stream' its MessagePack body (which carries the event id
+// itself), each with or without path enrichment. The result is shared by
+// every client of that variant.
+const messagePayloads = (data, id) => {
+  let parsed = null;
+  let enriched;
+  const streamMessage = () => (parsed = parsed || toStreamMessage(data));
+  // The parsed message with path enrichment, or null when there is nothing
+  // to enrich
+  const enrichedMessage = () => {
+    if (enriched === undefined) {
+      const message = streamMessage();
+      enriched = data.type === 'propagation' && message !== data ? { ...message, data: enrichPath(message.data) } : null;
+    }
+    return enriched;
+  };
+  const payloads = new Map();
+  return (format, enrich) => {
+    const key = `${format}:${enrich}`;
+    if (!payloads.has(key)) {
+      const message = enrich && enrichedMessage();
+      if (format === 'sse') {
+        payloads.set(key, JSON.stringify(message ? { ...data, data: JSON.stringify(message.data) } : data));
+      } else {
+        payloads.set(key, encodeMsgpack({ ...(message || streamMessage()), id }));
+      }
+    }
+    return payloads.get(key);
+  };
+};
+
+// Clients connecting with ?batch=1 get messages gathered over EVENT_BATCH_MS
+// (or until EVENT_BATCH_MAX are pending) as a single
+// {type: 'batch', events: [...]} message, built from the per-message payloads
+// without serializing them again.
+const EVENT_BATCH_MS = parseInt(process.env.EVENT_BATCH_MS, 10) || 20;
+const EVENT_BATCH_MAX = 256;
+const pendingBatch = []; // event log entries not yet sent to batched clients
+let batchTimer = null;
+
+// Every broadcast message gets an id, <epoch>-<sequence>, and the last
+// EVENT_REPLAY_SIZE messages are kept. A client reconnecting with
+// Last-Event-ID gets the messages it missed replayed in a burst; when the
+// log no longer reaches back that far (or the server restarted), it is
+// first told with a {type: 'replayGap', missed} message.
+const EVENT_REPLAY_SIZE = parseInt(process.env.EVENT_REPLAY_SIZE, 10) || 1024;
+const EVENT_EPOCH = Date.now().toString(36);
+const eventLog = []; // { seq, id, payload }
+let nextEventSeq = 1;
+let replayGaps = 0;
+
+const msgpackArrayHeader = (length) => {
+  if (length <= 15) {
+    return Buffer.from([0x90 | length]);
+  }
+  const header = Buffer.allocUnsafe(length <= 0xffff ? 3 : 5);
+  if (length <= 0xffff) {
+    header[0] = 0xdc;
+    header.writeUInt16BE(length, 1);
+  } else {
+    header[0] = 0xdd;
+    header.writeUInt32BE(length, 1);
+  }
+  return header;
+};
+
+// Writes one frame per client, built once per format/enrichment variant
+const sendToClients = (clients, format, selected, buildFrame) => {
+  const frames = new Map();
+  clients.filter(selected).forEach(client => {
+    const key = `${client.enrichPaths}`;
+    if (!frames.has(key)) {
+      frames.set(key, buildFrame(client.enrichPaths));
+    }
     try {
-      client.res.write(`data: ${JSON.stringify(data)}\n\n`);
+      client.stream.write(frames.get(key));
     } catch (error) {
-      console.error('Error sending SSE:', error);
+      console.error(`Error sending ${format === 'sse' ? 'SSE' : 'stream frame'}:`, error);
       // Remove client if there's an error
-      const index = sseClients.indexOf(client);
-      if (index > -1) {
-        sseClients.splice(index, 1);
-      }
+      removeClient(clients, client);
     }
   });
 };
 
+const eventFrame = (format, enrich, entry) => (format === 'sse'
+  ? Buffer.from(`id: ${entry.id}\ndata: ${entry.payload('sse', enrich)}\n\n`)
+  : frameStreamBody(entry.payload('stream', enrich)));
+
+// One {type: 'batch', events} frame; its id is that of the last message
+const batchFrame = (format, enrich, entries) => {
+  const id = entries[entries.length - 1].id;
+  if (format === 'sse') {
+    const events = entries.map(entry => entry.payload('sse', enrich)).join(',');
+    return Buffer.from(`id: ${id}\ndata: {"type":"batch","events":[${events}]}\n\n`);
+  }
+  return frameStreamBody(Buffer.concat([
+    // {type: 'batch', id, events: } up to the array header
+    encodeMsgpack({ type: 'batch', id, events: [] }).subarray(0, -1),
+    msgpackArrayHeader(entries.length),
+    ...entries.map(entry => entry.payload('stream', enrich))
+  ]));
+};
+
+const flushBatch = () => {
+  clearTimeout(batchTimer);
+  batchTimer = null;
+  const batch = pendingBatch.splice(0);
+  if (batch.length === 0) {
+    return;
+  }
+  const batched = client => client.batchEvents;
+  sendToClients(sseClients, 'sse', batched, enrich => batchFrame('sse', enrich, batch));
+  sendToClients(streamClients, 'stream', batched, enrich => batchFrame('stream', enrich, batch));
+};
+
+const broadcastToSSE = (data) => {
+  const seq = nextEventSeq++;
+  const id = `${EVENT_EPOCH}-${seq}`;
+  const entry = { seq, id, payload: messagePayloads(data, id) };
+  eventLog.push(entry);
+  if (eventLog.length > EVENT_REPLAY_SIZE) {
+    eventLog.shift();
+  }
+
+  const immediate = client => !client.batchEvents;
+  sendToClients(sseClients, 'sse', immediate, enrich => eventFrame('sse', enrich, entry));
+  sendToClients(streamClients, 'stream', immediate, enrich => eventFrame('stream', enrich, entry));
+
+  if (!sseClients.some(client => client.batchEvents) && !streamClients.some(client => client.batchEvents)) {
+    return;
+  }
+  pendingBatch.push(entry);
+  if (pendingBatch.length >= EVENT_BATCH_MAX) {
+    flushBatch();
+  } else if (!batchTimer) {
+    batchTimer = setTimeout(flushBatch, EVENT_BATCH_MS);
+  }
+};
+
+// Replays what a reconnecting client missed according to its Last-Event-ID.
+// Messages still waiting in pendingBatch are left to the next batch.
+const replayMissedEvents = (req, client, format) => {
+  const lastId = req.headers['last-event-id'];
+  if (!lastId) {
+    return;
+  }
+  const [epoch, seqText] = String(lastId).split('-');
+  const seq = Number(seqText);
+  const oldest = eventLog.length > 0 ? eventLog[0].seq : nextEventSeq;
+  const known = epoch === EVENT_EPOCH && Number.isInteger(seq) && seq < nextEventSeq;
+  const missed = known ? Math.max(0, oldest - seq - 1) : null;
+  const pendingFrom = client.batchEvents && pendingBatch.length > 0 ? pendingBatch[0].seq : nextEventSeq;
+  const replay = eventLog.filter(entry => (!known || entry.seq > seq) && entry.seq < pendingFrom);
+
+  if (missed !== 0) {
+    replayGaps++;
+    console.warn(`Replay gap for ${req.socket.remoteAddress} (Last-Event-ID ${lastId}): ` +
+      `${missed === null ? 'unknown number of' : missed} messages lost, ${replayGaps} gaps so far`);
+    const gap = { type: 'replayGap', missed };
+    client.stream.write(format === 'sse' ? `data: ${JSON.stringify(gap)}\n\n` : encodeStreamFrame(gap));
+  }
+  if (replay.length === 0) {
+    return;
+  }
+  if (client.batchEvents) {
+    client.stream.write(batchFrame(format, client.enrichPaths, replay));
+  } else {
+    replay.forEach(entry => client.stream.write(eventFrame(format, client.enrichPaths, entry)));
+  }
+  console.log(`Replayed ${replay.length} messages after ${lastId}`);
+};
+
+const describeClient = (client) => {
+  const stats = client.stream.stats();
+  return `${stats.dropped} dropped, max lag ${stats.maxLagMs}ms`;
+};
+
+// Backlog and lag of every connected event-stream client
+app.get('/api/stream-clients', (req, res) => {
+  const describe = (kind) => (client) => ({
+    id: client.id,
+    kind,
+    address: client.res.socket ? client.res.socket.remoteAddress : null,
+    connectedMs: Date.now() - client.id,
+    enrichPaths: client.enrichPaths,
+    batchEvents: client.batchEvents,
+    ...client.stream.stats()
+  });
+  res.json([...sseClients.map(describe('sse')), ...streamClients.map(describe('stream'))]);
+});
+
 // Handle SSE connections
 app.get('/sse', (req, res) => {
   console.log('SSE client connected');
-  res.writeHead(200, {
+  const stream = openEventStream(req, res, {
     'Content-Type': 'text/event-stream',
     'Connection': 'keep-alive',
     'Cache-Control': 'no-cache',
@@ -258,22 +989,26 @@ app.get('/sse', (req, res) => {
   const clientId = Date.now();
   const client = {
     id: clientId,
-    res
+    res,
+    stream,
+    enrichPaths: req.query.enrich === '1',
+    batchEvents: req.query.batch === '1'
   };
 
   sseClients.push(client);
 
   // Send initial data
-  res.write(`data: ${JSON.stringify({
+  stream.write(`data: ${JSON.stringify({
     type: 'connected',
     message: 'SSE connection established',
     connectionStatus: connectionStatus
   })}\n\n`);
+  replayMissedEvents(req, client, 'sse');
 
   // Send connection status updates
   const statusInterval = setInterval(() => {
     try {
-      res.write(`data: ${JSON.stringify({
+      stream.write(`data: ${JSON.stringify({
         type: 'statusUpdate',
         connectionStatus: connectionStatus
       })}\n\n`);
@@ -285,12 +1020,63 @@ app.get('/sse', (req, res) => {
 
   // Remove client when connection closes
   req.on('close', () => {
-    console.log('SSE client disconnected');
-    const index = sseClients.indexOf(client);
-    if (index > -1) {
-      sseClients.splice(index, 1);
+    console.log(`SSE client disconnected (${describeClient(client)})`);
+    removeClient(sseClients, client);
+    clearInterval(statusInterval);
+    stream.end();
+  });
+});
+
+// Binary alternative to /sse for the native client: the same messages as
+// length-prefixed MessagePack frames, with packet/propagation payloads sent
+// as parsed objects instead of JSON strings. Clients opt in with
+// "Accept: application/msgpack".
+app.get('/stream', (req, res) => {
+  if (!req.accepts('application/msgpack')) {
+    res.status(406).json({ error: 'Only application/msgpack is available on /stream' });
+    return;
+  }
+  console.log('Stream client connected');
+  const stream = openEventStream(req, res, {
+    'Content-Type': 'application/msgpack',
+    'Connection': 'keep-alive',
+    'Cache-Control': 'no-cache',
+    'Access-Control-Allow-Origin': '*'
+  });
+
+  const client = {
+    id: Date.now(),
+    res,
+    stream,
+    enrichPaths: req.query.enrich === '1',
+    batchEvents: req.query.batch === '1'
+  };
+
+  streamClients.push(client);
+
+  stream.write(encodeStreamFrame({
+    type: 'connected',
+    message: 'Stream connection established',
+    connectionStatus: connectionStatus
+  }));
+  replayMissedEvents(req, client, 'stream');
+
+  const statusInterval = setInterval(() => {
+    try {
+      stream.write(encodeStreamFrame({
+        type: 'statusUpdate',
+        connectionStatus: connectionStatus
+      }));
+    } catch (error) {
+      clearInterval(statusInterval);
     }
+  }, 5000);
+
+  req.on('close', () => {
+    console.log(`Stream client disconnected (${describeClient(client)})`);
+    removeClient(streamClients, client);
     clearInterval(statusInterval);
+    stream.end();
   });
 });
 
@@ -299,7 +1085,24 @@ const PORT = process.env.PORT || 3000;
 server.listen(PORT, () => {
   console.log(`Server running on port ${PORT}`);
   console.log(`Web UI (optional): http://localhost:${PORT}`);
+
+  if (socketServer) {
+    // A socket file left behind by an earlier run would make listen fail
+    try {
+      if (fs.statSync(socketPath).isSocket()) {
+        fs.unlinkSync(socketPath);
+      }
+    } catch (error) {
+      // Nothing to clean up
+    }
+    socketServer.on('error', error => console.error(`Unix socket ${socketPath}:`, error.message));
+    socketServer.listen(socketPath, () => console.log(`Native client socket: ${UNIX_URL_PREFIX}${socketPath}`));
+  }
   
   // Set up WebSocket proxy connections
-  setupWebSocketProxy();
+  upstreams.forEach(upstream => upstream.start());
+
+  // Keep the shared adverts cache warm
+  refreshAdverts();
+  setInterval(refreshAdverts, ADVERTS_REFRESH_MS);
 });